@@ -0,0 +1,439 @@
+// Performance harness for the client: serialization of every Visualizable
+// type, end-to-end feed throughput, the feed queue under concurrent
+// producers and EventQueue. Prints one JSON object per line, e.g.
+//
+//     {"bench": "serialize", "case": "sentence/200", "path": "write_json",
+//      "ns_per_op": 5120.3, "bytes": 4711}
+//
+//     ./dali_visualizer_bench [--filter substring] [--redis host:port]
+//                             [--redis-unix socket_path]
+//
+// Feed benchmarks run over an in-process broker, and over redis (TCP at
+// 127.0.0.1:6379 by default, and a Unix socket if given); redis cases
+// report "skipped" if no server answers.
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <json11.hpp>
+
+#include "dali_visualizer/EventQueue.h"
+#include "dali_visualizer/TimingWheel.h"
+#include "dali_visualizer/visualizer.h"
+
+using namespace std::chrono;
+using namespace dali::visualizer;
+using json11::Json;
+
+typedef steady_clock bench_clock_t;
+
+static std::atomic<size_t> num_allocations(0);
+
+void* operator new(size_t size) {
+    num_allocations++;
+    void* ptr = malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+static std::string filter;
+
+static bool selected(const std::string& name) {
+    return filter.empty() || name.find(filter) != std::string::npos;
+}
+
+static void report(Json::object result) {
+    printf("%s\n", Json(result).dump().c_str());
+    fflush(stdout);
+}
+
+static double ns_since(bench_clock_t::time_point start) {
+    return duration_cast<nanoseconds>(bench_clock_t::now() - start).count();
+}
+
+// runs f until at least min_time has passed, returns ns per call.
+static double time_per_op(std::function<void()> f, milliseconds min_time=milliseconds(200)) {
+    f();
+    size_t iterations = 0;
+    auto start = bench_clock_t::now();
+    auto stop = start + min_time;
+    do {
+        f();
+        iterations++;
+    } while (bench_clock_t::now() < stop);
+    return ns_since(start) / iterations;
+}
+
+/* serialization */
+
+static std::mt19937 rng(1234);
+
+static std::vector<std::string> random_tokens(int n) {
+    static const char* words[] = {"the", "cat", "sat", "on", "a", "mat", "while",
+                                  "gradient", "descent", "converged", "slowly", ","};
+    std::vector<std::string> tokens;
+    for (int i = 0; i < n; ++i) {
+        tokens.push_back(words[rng() % 12]);
+    }
+    return tokens;
+}
+
+static std::vector<float> random_weights(int n) {
+    std::vector<float> weights;
+    std::uniform_real_distribution<float> uniform(0, 1);
+    for (int i = 0; i < n; ++i) {
+        weights.push_back(uniform(rng));
+    }
+    return weights;
+}
+
+static std::shared_ptr<Sentence<float>> make_sentence(int length) {
+    auto sentence = std::make_shared<Sentence<float>>(random_tokens(length));
+    sentence->set_weights(random_weights(length));
+    return sentence;
+}
+
+static std::shared_ptr<Sentences<float>> make_sentences(int count, int length) {
+    std::vector<std::shared_ptr<Sentence<float>>> sentences;
+    for (int i = 0; i < count; ++i) {
+        sentences.push_back(make_sentence(length));
+    }
+    auto result = std::make_shared<Sentences<float>>(sentences);
+    result->set_weights(random_weights(count));
+    return result;
+}
+
+static std::shared_ptr<Tree> make_tree(int depth, int branching) {
+    if (depth == 0)
+        return std::make_shared<Tree>(random_tokens(1)[0]);
+    std::vector<std::shared_ptr<Tree>> children;
+    for (int i = 0; i < branching; ++i) {
+        children.push_back(make_tree(depth - 1, branching));
+    }
+    return std::make_shared<Tree>(random_tokens(1)[0], children);
+}
+
+static void bench_serialize(const std::string& name, std::shared_ptr<Visualizable> obj) {
+    if (!selected("serialize/" + name))
+        return;
+    std::string dumped;
+    double dump_ns = time_per_op([&]() {
+        dumped = obj->to_json().dump();
+    });
+    report(Json::object {
+        { "bench", "serialize" }, { "case", name }, { "path", "to_json+dump" },
+        { "ns_per_op", dump_ns }, { "bytes", (double)dumped.size() },
+    });
+    JsonWriter writer;
+    double write_ns = time_per_op([&]() {
+        writer.clear();
+        obj->write_json(writer);
+    });
+    report(Json::object {
+        { "bench", "serialize" }, { "case", name }, { "path", "write_json" },
+        { "ns_per_op", write_ns }, { "bytes", (double)writer.size() },
+    });
+    std::pair<const char*, NumberFormat> formats[] = {
+        { "write_json/shortest_float32", NumberFormat(0, true) },
+        { "write_json/4_digits", NumberFormat(4, true) },
+    };
+    for (auto& format: formats) {
+        writer.set_number_format(format.second);
+        double format_ns = time_per_op([&]() {
+            writer.clear();
+            obj->write_json(writer);
+        });
+        report(Json::object {
+            { "bench", "serialize" }, { "case", name }, { "path", format.first },
+            { "ns_per_op", format_ns }, { "bytes", (double)writer.size() },
+        });
+    }
+}
+
+static void bench_serialization() {
+    bench_serialize("sentence/200", make_sentence(200));
+    bench_serialize("sentences/20x50", make_sentences(20, 50));
+    bench_serialize("qa/10x30", std::make_shared<QA<float>>(
+            make_sentences(10, 30), make_sentence(15), make_sentence(5)));
+
+    auto grid = std::make_shared<GridLayout>();
+    for (int column = 0; column < 4; ++column) {
+        for (int row = 0; row < 8; ++row) {
+            grid->add_in_column(column, make_sentence(30));
+        }
+    }
+    bench_serialize("grid/4x8", grid);
+
+    bench_serialize("tree/3^6", make_tree(6, 3));
+
+    std::vector<std::string> labels;
+    for (int i = 0; i < 1000; ++i) {
+        labels.push_back("label_" + std::to_string(i));
+    }
+    bench_serialize("finite_distribution/1000", std::make_shared<FiniteDistribution<float>>(
+            random_weights(1000), labels));
+    bench_serialize("finite_distribution/1000/top20", std::make_shared<FiniteDistribution<float>>(
+            random_weights(1000), labels, 20));
+}
+
+/* feed */
+
+static uint64_t total_published(Visualizer& visualizer) {
+    uint64_t messages = 0;
+    auto stats = visualizer.stats_json();
+    for (auto& kv: stats["channels"].object_items()) {
+        messages += kv.second["messages"].number_value();
+    }
+    return messages;
+}
+
+// received, if given, counts the messages a subscriber got; it is
+// reported so the publish rate can be checked against delivery.
+static void bench_feed(const std::string& transport_name, std::shared_ptr<Transport> transport,
+                       const std::atomic<uint64_t>* received=nullptr) {
+    if (!selected("feed/" + transport_name))
+        return;
+    Visualizer visualizer("dali_visualizer_bench", transport);
+    visualizer.enable_async_feed(1 << 16, OverflowPolicy::BLOCK);
+
+    auto give_up = bench_clock_t::now() + seconds(3);
+    while (total_published(visualizer) == 0 && bench_clock_t::now() < give_up) {
+        visualizer.feed(Json::object { { "type", "bench_warmup" } });
+        std::this_thread::sleep_for(milliseconds(100));
+    }
+    if (total_published(visualizer) == 0) {
+        report(Json::object {
+            { "bench", "feed" }, { "transport", transport_name },
+            { "skipped", "could not connect" },
+        });
+        return;
+    }
+
+    auto sentence = make_sentence(50);
+    for (int batched = 0; batched < 2; ++batched) {
+        if (batched)
+            visualizer.enable_feed_batching(milliseconds(5));
+        const int num_messages = 20000;
+        uint64_t before = total_published(visualizer);
+        uint64_t received_before = received != nullptr ? received->load() : 0;
+        auto start = bench_clock_t::now();
+        for (int i = 0; i < num_messages; ++i) {
+            visualizer.feed(*sentence);
+        }
+        // pipelined batching still publishes every message on its own.
+        auto timeout = start + seconds(60);
+        while (total_published(visualizer) - before < num_messages) {
+            if (bench_clock_t::now() > timeout) {
+                report(Json::object { { "bench", "feed" }, { "error", "timed out publishing" } });
+                return;
+            }
+            std::this_thread::sleep_for(microseconds(100));
+        }
+        double elapsed_ns = ns_since(start);
+        Json::object result {
+            { "bench", "feed" }, { "case", batched ? "sentence/50/batched" : "sentence/50" },
+            { "transport", transport_name },
+            { "messages_per_s", num_messages * 1e9 / elapsed_ns },
+            { "feed_ns_per_op", elapsed_ns / num_messages },
+        };
+        if (received != nullptr) {
+            // may include a heartbeat or two.
+            result["received"] = (double)(received->load() - received_before);
+            result["sent"] = (double)num_messages;
+        }
+        report(result);
+    }
+}
+
+// Cost of Visualizer::feed in async mode as seen by each of num_threads
+// producers, with the publisher thread draining into an in-process
+// broker; should stay flat with PER_THREAD sharding.
+static void bench_feed_queue(FeedSharding sharding, int num_threads) {
+    std::string name = sharding == FeedSharding::PER_THREAD ? "per_thread" : "shared";
+    if (!selected("feed_queue/" + name))
+        return;
+    auto broker = std::make_shared<InProcessBroker>();
+    std::vector<double> push_ns(num_threads);
+    {
+        Visualizer visualizer("dali_visualizer_bench", std::make_shared<InProcessTransport>(broker));
+        // producers outpace the publisher; dropping keeps them from
+        // waiting on it, so this measures feed itself.
+        visualizer.enable_async_feed(1 << 16, OverflowPolicy::DROP_OLDEST, sharding);
+        const int messages_per_thread = 100000;
+        std::vector<std::thread> producers;
+        for (int t = 0; t < num_threads; ++t) {
+            producers.emplace_back([&visualizer, &push_ns, t]() {
+                // one per thread, so producers do not share its refcount.
+                Json message = Json::object { { "type", "bench" }, { "thread", t } };
+                auto start = bench_clock_t::now();
+                for (int i = 0; i < messages_per_thread; ++i) {
+                    visualizer.feed(message);
+                }
+                push_ns[t] = ns_since(start) / messages_per_thread;
+            });
+        }
+        for (auto& producer: producers) {
+            producer.join();
+        }
+    }
+    double mean_ns = 0;
+    for (double ns: push_ns) {
+        mean_ns += ns / num_threads;
+    }
+    report(Json::object {
+        { "bench", "feed_queue" }, { "sharding", name },
+        { "threads", num_threads }, { "feed_ns_per_op", mean_ns },
+    });
+}
+
+/* EventQueue */
+
+static void bench_timer_backend(const char* name, std::unique_ptr<TimerBackend> backend, int num_timers) {
+    if (!selected(std::string("event_queue/backend/") + name))
+        return;
+    auto now = TimerBackend::clock_t::now();
+    std::vector<TimerBackend::time_point_t> deadlines(num_timers);
+    for (auto& deadline: deadlines) {
+        deadline = now + milliseconds(1000 + rng() % 59000);
+    }
+    backend->reserve(num_timers);
+
+    auto start = bench_clock_t::now();
+    for (int i = 0; i < num_timers; ++i) {
+        backend->insert(i, deadlines[i]);
+    }
+    double insert_ns = ns_since(start) / num_timers;
+
+    start = bench_clock_t::now();
+    for (int i = 0; i < num_timers; i += 2) {
+        backend->remove(i);
+    }
+    double cancel_ns = ns_since(start) / (num_timers / 2);
+
+    // fire everything that is left, walking time forward 1ms at a time.
+    int fired = 0;
+    TimerBackend::slot_t slot;
+    start = bench_clock_t::now();
+    for (auto t = now; backend->size() > 0; t += milliseconds(1)) {
+        while (backend->pop_due(t, slot)) {
+            fired++;
+        }
+    }
+    double fire_ns = ns_since(start) / fired;
+
+    report(Json::object {
+        { "bench", "event_queue" }, { "case", "backend" }, { "backend", name },
+        { "pending", num_timers },
+        { "insert_ns", insert_ns }, { "cancel_ns", cancel_ns }, { "fire_ns", fire_ns },
+    });
+}
+
+static void bench_event_queue(const char* name, EventQueue::Backend backend, int num_timers) {
+    if (!selected(std::string("event_queue/queue/") + name))
+        return;
+    // keep num_timers far-away timers pending, and measure how fast a
+    // stream of immediate tasks gets through.
+    double push_run_ns;
+    {
+        EventQueue queue(backend);
+        auto far = EventQueue::clock_t::now() + hours(1);
+        for (int i = 0; i < num_timers; ++i) {
+            queue.push([]() {}, far);
+        }
+        const int num_tasks = 100000;
+        std::atomic<int> done(0);
+        auto start = bench_clock_t::now();
+        for (int i = 0; i < num_tasks; ++i) {
+            queue.push([&done]() { done++; });
+        }
+        while (done.load() < num_tasks) {
+            std::this_thread::yield();
+        }
+        push_run_ns = ns_since(start) / num_tasks;
+    }
+
+    // a repeating task plus a stream of one-shot tasks; the first rounds
+    // grow the pool and worker rings, the last is measured.
+    size_t allocations = 0;
+    const int num_tasks = 100000;
+    {
+        EventQueue queue(backend, 2);
+        auto handle = queue.run_every([]() {}, microseconds(100));
+        for (int round = 0; round < 3; ++round) {
+            std::atomic<int> done(0);
+            size_t before = num_allocations.load();
+            for (int i = 0; i < num_tasks; ++i) {
+                queue.push([&done]() { done++; });
+            }
+            while (done.load() < num_tasks) {
+                std::this_thread::yield();
+            }
+            allocations = num_allocations.load() - before;
+        }
+    }
+
+    report(Json::object {
+        { "bench", "event_queue" }, { "case", "queue" }, { "backend", name },
+        { "pending", num_timers },
+        { "push_run_ns", push_run_ns },
+        { "steady_state_allocations_per_task", (double)allocations / num_tasks },
+    });
+}
+
+int main(int argc, char** argv) {
+    std::string host = "127.0.0.1";
+    int port = 6379;
+    std::string socket_path;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (strcmp(argv[i], "--redis") == 0 && i + 1 < argc) {
+            std::string address = argv[++i];
+            auto colon = address.rfind(':');
+            host = address.substr(0, colon);
+            if (colon != std::string::npos)
+                port = atoi(address.c_str() + colon + 1);
+        } else if (strcmp(argv[i], "--redis-unix") == 0 && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--filter substring] [--redis host:port] "
+                            "[--redis-unix socket_path]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    bench_serialization();
+
+    bench_timer_backend("heap", std::unique_ptr<TimerBackend>(new HeapTimerBackend()), 100000);
+    bench_timer_backend("timing_wheel", std::unique_ptr<TimerBackend>(new TimingWheel()), 100000);
+    bench_event_queue("heap", EventQueue::Backend::HEAP, 100000);
+    bench_event_queue("timing_wheel", EventQueue::Backend::TIMING_WHEEL, 100000);
+
+    for (int threads: {1, 4, 16, 32}) {
+        bench_feed_queue(FeedSharding::SHARED, threads);
+        bench_feed_queue(FeedSharding::PER_THREAD, threads);
+    }
+
+    auto broker = std::make_shared<InProcessBroker>();
+    std::atomic<uint64_t> received(0);
+    broker->subscribe("updates_*", [&received](const std::string&, const std::string&) {
+        received++;
+    });
+    bench_feed("in_process", std::make_shared<InProcessTransport>(broker), &received);
+    bench_feed("redis_tcp", redis_transport(host, port));
+    if (!socket_path.empty())
+        bench_feed("redis_unix", redis_unix_transport(socket_path));
+}
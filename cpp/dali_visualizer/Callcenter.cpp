@@ -0,0 +1,137 @@
+#include "Callcenter.h"
+
+#include <chrono>
+#include <exception>
+#include <iostream>
+
+using json11::Json;
+
+namespace dali {
+    namespace visualizer {
+        /* CallcenterCall */
+
+        CallcenterCall::CallcenterCall(std::string name_, Json payload_, Json id_, send_t send_) :
+                name(name_),
+                payload(payload_),
+                id(id_),
+                send(send_) {
+        }
+
+        Json::object CallcenterCall::header(bool last) {
+            done = last;
+            return Json::object {
+                { "type", "reply" },
+                { "id", id },
+                { "name", name },
+                { "done", last },
+            };
+        }
+
+        void CallcenterCall::reply(Json result) {
+            std::lock_guard<std::mutex> guard(reply_mutex);
+            if (done)
+                return;
+            auto message = header(true);
+            message["result"] = result;
+            send(message);
+        }
+
+        void CallcenterCall::stream(Json part) {
+            std::lock_guard<std::mutex> guard(reply_mutex);
+            if (done)
+                return;
+            auto message = header(false);
+            message["part"] = part;
+            message["sequence"] = sequence++;
+            send(message);
+        }
+
+        void CallcenterCall::finish() {
+            std::lock_guard<std::mutex> guard(reply_mutex);
+            if (done)
+                return;
+            auto message = header(true);
+            message["sequence"] = sequence;
+            send(message);
+        }
+
+        void CallcenterCall::fail(const std::string& error) {
+            std::lock_guard<std::mutex> guard(reply_mutex);
+            if (done)
+                return;
+            auto message = header(true);
+            message["error"] = error;
+            send(message);
+        }
+
+        bool CallcenterCall::finished() {
+            std::lock_guard<std::mutex> guard(reply_mutex);
+            return done;
+        }
+
+        /* Callcenter */
+
+        Callcenter::Callcenter(CallcenterCall::send_t send_, VisualizerStats& stats_, int num_workers) :
+                send(send_),
+                stats(stats_),
+                registry(std::make_shared<registry_t>()),
+                workers(EventQueue::Backend::HEAP, num_workers) {
+        }
+
+        void Callcenter::register_handler(std::string name, handler_t handler) {
+            std::lock_guard<std::mutex> guard(registry_mutex);
+            auto updated = std::make_shared<registry_t>(*std::atomic_load(&registry));
+            (*updated)[name] = handler;
+            std::atomic_store(&registry, std::shared_ptr<const registry_t>(updated));
+        }
+
+        void Callcenter::dispatch(const std::string& message) {
+            std::string error;
+            auto request = Json::parse(message, error);
+
+            if (!error.empty()) {
+                std::cout << "VISUALIZER WARNING: error in requestion json: " << error << std::endl;
+                return;
+            }
+
+            if (request["name"].is_null()) {
+                std::cout << "VISUALIZER WARNING: received request without function name." << std::endl;
+                return;
+            }
+            auto& name = request["name"].string_value();
+            auto call = std::make_shared<CallcenterCall>(name, request["payload"], request["id"], send);
+
+            auto current = std::atomic_load(&registry);
+            auto handler = current->find(name);
+            if (handler == current->end()) {
+                std::cout << "VISUALIZER WARNING: Requested function <" << name << "> not supported (did you forget to register?)." << std::endl;
+                if (!call->id.is_null())
+                    call->fail("unknown function");
+                return;
+            }
+
+            // the snapshot keeps the handler alive even if it is
+            // replaced in the meantime.
+            const handler_t* f = &handler->second;
+            auto received = std::chrono::steady_clock::now();
+            workers.push([this, current, f, call, received]() {
+                auto start = std::chrono::steady_clock::now();
+                stats.callcenter_queue_time.record(std::chrono::duration_cast<std::chrono::nanoseconds>(start - received));
+                try {
+                    (*f)(call);
+                } catch (std::exception& e) {
+                    std::cout << "VISUALIZER WARNING: function <" << call->name << "> failed: " << e.what() << std::endl;
+                    call->fail(e.what());
+                } catch (...) {
+                    std::cout << "VISUALIZER WARNING: function <" << call->name << "> failed: unknown exception" << std::endl;
+                    call->fail("unknown exception");
+                }
+                stats.callcenter_dispatch_time.record_since<std::chrono::steady_clock>(start);
+            });
+        }
+
+        void Callcenter::stop() {
+            workers.stop();
+        }
+    }
+}
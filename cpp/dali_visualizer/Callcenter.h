@@ -0,0 +1,90 @@
+#ifndef DALI_VISUALIZER_CALLCENTER_H
+#define DALI_VISUALIZER_CALLCENTER_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <json11.hpp>
+
+#include "dali_visualizer/EventQueue.h"
+#include "dali_visualizer/Stats.h"
+
+namespace dali {
+    namespace visualizer {
+        // One callcenter request being answered. Replies are fed as
+        //
+        //     {"type": "reply", "id": .., "name": .., "done": true,
+        //      "result": ..}
+        //
+        // echoing the request's "id" (null if it had none). Large results
+        // can go out as a stream of {"part": .., "sequence": n,
+        // "done": false} replies closed by finish(). A handler may keep
+        // the call and answer later from any thread, as long as the
+        // Visualizer is still alive. Anything sent after the final reply
+        // is ignored.
+        class CallcenterCall {
+            public:
+                typedef std::function<void(const json11::Json&)> send_t;
+
+                const std::string name;
+                const json11::Json payload;
+                const json11::Json id;
+            private:
+                send_t send;
+                std::mutex reply_mutex;
+                bool done = false;
+                int sequence = 0;
+
+                json11::Json::object header(bool last);
+            public:
+                CallcenterCall(std::string name, json11::Json payload, json11::Json id, send_t send);
+
+                void reply(json11::Json result);
+                void stream(json11::Json part);
+                void finish();
+                void fail(const std::string& error);
+
+                bool finished();
+        };
+
+        // Registry of callcenter functions and their dispatch. Requests
+        // are {"name": .., "payload": .., "id": ..} with id optional;
+        // each runs on a pool of num_workers, so a slow handler only
+        // holds up its own request. Handlers may therefore run
+        // concurrently with each other.
+        class Callcenter {
+            public:
+                typedef std::function<void(std::shared_ptr<CallcenterCall>)> handler_t;
+            private:
+                typedef std::unordered_map<std::string, handler_t> registry_t;
+
+                CallcenterCall::send_t send;
+                VisualizerStats& stats;
+
+                // copied on write and swapped with atomic_store, so
+                // dispatch never waits for a registration.
+                std::mutex registry_mutex;
+                std::shared_ptr<const registry_t> registry;
+
+                EventQueue workers;
+            public:
+                Callcenter(CallcenterCall::send_t send, VisualizerStats& stats, int num_workers);
+
+                void register_handler(std::string name, handler_t handler);
+
+                // Parses message and queues the call. Malformed and
+                // unknown requests are reported on stdout (and answered
+                // with an error if they carry an id).
+                void dispatch(const std::string& message);
+
+                // Requests not started yet are dropped; the ones running
+                // complete.
+                void stop();
+        };
+    }
+}
+
+#endif
@@ -1,104 +1,318 @@
 #include "EventQueue.h"
 
+#include <algorithm>
 #include <iostream>
 
+#include "dali_visualizer/TimingWheel.h"
+
 using namespace std::chrono;
 
 
-EQHandle::EQHandle(std::shared_ptr<bool> run_again) : run_again(run_again) {
-    *run_again = true;
+EQHandle::EQHandle(std::shared_ptr<Link> link, TimerBackend::timer_id_t timer) :
+        link(link), timer(timer) {
 }
 EQHandle::~EQHandle() {
     stop();
 }
 void EQHandle::stop() {
-    *run_again = false;
+    // destroyed once both locks are released: it may hold the last
+    // reference to another handle.
+    Task cancelled;
+    std::lock_guard<decltype(link->mutex)> lock(link->mutex);
+    if (link->queue != nullptr)
+        link->queue->cancel(timer, cancelled);
 }
 
-void EventQueue::run_thread_internal() {
-     while (true) {
-        if (should_terminate)
-            break;
-        bool good_to_go = false;
-        duration_t should_sleep_for = between_queue_checks;
-        time_point_t dont_run_before;
-
-        std::function<void()> f;
-        {
-            std::lock_guard<decltype(queue_mutex)> lock(queue_mutex);
-            if (!work.empty()) {
-                std::tie(dont_run_before, f) = work.top();
-                time_point_t now = clock_t::now();
-                if (dont_run_before < now) {
-                    work.pop();
-                    good_to_go = true;
-                } else {
-                    // Sleep at most between queue checks.
-                    // Ideally time before next event.
-                    should_sleep_for = dont_run_before - now;
-                }
-            }
+const EventQueue::slot_t EventQueue::NO_SLOT;
+
+EventQueue::timer_id_t EventQueue::timer_id(slot_t slot, uint32_t generation) {
+    return ((timer_id_t)generation << 32) | slot;
+}
+
+EventQueue::slot_t EventQueue::acquire_slot() {
+    if (free_slots.empty()) {
+        size_t old_size = slots.size();
+        size_t new_size = std::max<size_t>(64, 2 * old_size);
+        slots.resize(new_size);
+        work->reserve(new_size);
+        free_slots.reserve(new_size);
+        for (size_t slot = new_size; slot > old_size; --slot) {
+            free_slots.push_back(slot - 1);
+        }
+    }
+    slot_t slot = free_slots.back();
+    free_slots.pop_back();
+    return slot;
+}
+
+void EventQueue::release_slot(slot_t slot) {
+    Slot& s = slots[slot];
+    s.repeating = false;
+    s.cancelled = false;
+    s.state = Slot::FREE;
+    s.generation++;
+    free_slots.push_back(slot);
+}
+
+bool EventQueue::rearm(slot_t slot, Task& task) {
+    Slot& s = slots[slot];
+    if (should_terminate || s.cancelled) {
+        release_slot(slot);
+        return false;
+    }
+    auto now = clock_t::now();
+    if (s.repeat == Repeat::FIXED_DELAY || s.period <= duration_t::zero()) {
+        s.deadline = now + s.period;
+    } else {
+        s.deadline += s.period;
+        if (s.deadline <= now && s.missed_ticks == MissedTicks::COALESCE) {
+            // the first deadline after now on the original grid.
+            s.deadline += s.period * ((now - s.deadline) / s.period + 1);
         }
+    }
+    s.task = std::move(task);
+    s.state = Slot::PENDING;
+    work->insert(slot, s.deadline);
+    work_ready.notify_all();
+    return true;
+}
 
-        if (good_to_go) {
+void EventQueue::run_thread_internal() {
+    std::unique_lock<decltype(queue_mutex)> lock(queue_mutex);
+    while (!should_terminate) {
+        slot_t slot;
+        if (work->pop_due(clock_t::now(), slot)) {
+            Slot& s = slots[slot];
+            bool repeats = s.repeating;
+            Task f = std::move(s.task);
+            if (repeats) {
+                s.state = Slot::RUNNING;
+            } else {
+                release_slot(slot);
+            }
+            lock.unlock();
+            if (!workers.empty()) {
+                dispatch({std::move(f), repeats ? slot : NO_SLOT});
+                lock.lock();
+                continue;
+            }
             f();
+            if (!repeats)
+                f.reset();
             std::this_thread::yield();
+            lock.lock();
+            if (repeats && !rearm(slot, f)) {
+                lock.unlock();
+                f.reset();
+                lock.lock();
+            }
+            continue;
+        }
+        time_point_t dont_run_before = work->next_deadline();
+        if (dont_run_before != time_point_t::max()) {
+            work_ready.wait_until(lock, dont_run_before);
+        } else if (backend == Backend::HEAP) {
+            work_ready.wait_for(lock, between_queue_checks);
         } else {
-                std::unique_lock<decltype(queue_mutex)> lock(queue_mutex);
-                work_ready.wait_for(lock, should_sleep_for, [this]{
-                    return not work.empty();
-                });
+            work_ready.wait(lock);
+        }
+    }
+}
+
+void EventQueue::ReadyRing::push_back(ReadyTask item) {
+    if (count == items.size()) {
+        std::vector<ReadyTask> grown(std::max<size_t>(16, 2 * items.size()));
+        for (size_t i = 0; i < count; ++i) {
+            grown[i] = std::move(items[(head + i) % items.size()]);
+        }
+        items.swap(grown);
+        head = 0;
+    }
+    items[(head + count) % items.size()] = std::move(item);
+    count++;
+}
+
+void EventQueue::ReadyRing::pop_front(ReadyTask& item) {
+    item = std::move(items[head]);
+    head = (head + 1) % items.size();
+    count--;
+}
+
+void EventQueue::dispatch(ReadyTask task) {
+    Worker& worker = *workers[next_worker];
+    next_worker = (next_worker + 1) % workers.size();
+    // counted before it can be taken, so num_ready never drops below
+    // the number of tasks in the deques (nor wraps around).
+    num_ready++;
+    {
+        std::lock_guard<decltype(worker.deque_mutex)> lock(worker.deque_mutex);
+        worker.tasks.push_back(std::move(task));
+    }
+    std::lock_guard<decltype(idle_mutex)> lock(idle_mutex);
+    tasks_ready.notify_one();
+}
+
+bool EventQueue::take_task(size_t worker, ReadyTask& task) {
+    for (size_t i = 0; i < workers.size(); ++i) {
+        Worker& victim = *workers[(worker + i) % workers.size()];
+        std::lock_guard<decltype(victim.deque_mutex)> lock(victim.deque_mutex);
+        if (victim.tasks.count > 0) {
+            victim.tasks.pop_front(task);
+            num_ready--;
+            return true;
         }
     }
+    return false;
 }
 
-bool EventQueue::cmp_work_item(work_item_t a, work_item_t b) {
-    return std::get<0>(a) > std::get<0>(b);
+void EventQueue::run_worker(size_t worker) {
+    ReadyTask ready;
+    while (!should_terminate) {
+        if (take_task(worker, ready)) {
+            ready.task();
+            if (ready.slot != NO_SLOT) {
+                std::lock_guard<decltype(queue_mutex)> lock(queue_mutex);
+                if (rearm(ready.slot, ready.task))
+                    continue;
+            }
+            ready.task.reset();
+            continue;
+        }
+        std::unique_lock<decltype(idle_mutex)> lock(idle_mutex);
+        tasks_ready.wait(lock, [this]() {
+            return should_terminate || num_ready.load() > 0;
+        });
+    }
 }
 
+static TimerBackend* make_backend(EventQueue::Backend backend) {
+    if (backend == EventQueue::Backend::TIMING_WHEEL)
+        return new TimingWheel();
+    return new HeapTimerBackend();
+}
 
-EventQueue::EventQueue() :
-        work(cmp_work_item),
-        event_thread([this]() { this->run_thread_internal(); }) {
+EventQueue::EventQueue(Backend backend_, int num_workers_) :
+        backend(backend_),
+        should_terminate(false),
+        work(make_backend(backend_)),
+        num_ready(0),
+        link(std::make_shared<EQHandle::Link>()) {
+    link->queue = this;
+    if (num_workers_ > 1) {
+        for (int i = 0; i < num_workers_; ++i) {
+            workers.emplace_back(new Worker());
+        }
+        for (int i = 0; i < num_workers_; ++i) {
+            workers[i]->thread = std::thread([this, i]() { this->run_worker(i); });
+        }
+    }
+    event_thread = std::thread([this]() { this->run_thread_internal(); });
 }
 
 EventQueue::~EventQueue() {
+    {
+        std::lock_guard<decltype(link->mutex)> lock(link->mutex);
+        link->queue = nullptr;
+    }
     stop();
 }
 
-void EventQueue::push(std::function<void()> f) {
-    push(f, duration_t::zero());
+EventQueue::timer_id_t EventQueue::push(Task f) {
+    return push(std::move(f), duration_t::zero());
 }
 
-void EventQueue::push(std::function<void()> f, time_point_t when_to_execute) {
+EventQueue::timer_id_t EventQueue::push(Task f, time_point_t when_to_execute) {
     std::lock_guard<decltype(queue_mutex)> lock(queue_mutex);
-    // we negate the time point for the queue to execute it at the right time.
-    work.push(std::make_tuple(when_to_execute, f));
+    slot_t slot = acquire_slot();
+    Slot& s = slots[slot];
+    s.task = std::move(f);
+    s.state = Slot::PENDING;
+    work->insert(slot, when_to_execute);
     work_ready.notify_all();
+    return timer_id(slot, s.generation);
+}
+
+EventQueue::timer_id_t EventQueue::push(Task f, duration_t wait_before_execution) {
+    return push(std::move(f), clock_t::now() + wait_before_execution);
+}
+
+bool EventQueue::cancel(timer_id_t timer) {
+    // destroyed once the lock is released.
+    Task cancelled;
+    return cancel(timer, cancelled);
+}
+
+bool EventQueue::cancel(timer_id_t timer, Task& cancelled) {
+    std::lock_guard<decltype(queue_mutex)> lock(queue_mutex);
+    slot_t slot = timer & UINT32_MAX;
+    if (slot >= slots.size())
+        return false;
+    Slot& s = slots[slot];
+    if (s.generation != (timer >> 32) || s.state == Slot::FREE || s.cancelled)
+        return false;
+    if (s.state == Slot::RUNNING) {
+        // released by rearm once the current run is over.
+        s.cancelled = true;
+        return true;
+    }
+    work->remove(slot);
+    cancelled = std::move(s.task);
+    release_slot(slot);
+    return true;
+}
+
+size_t EventQueue::size() {
+    std::lock_guard<decltype(queue_mutex)> lock(queue_mutex);
+    return work->size();
 }
 
-void EventQueue::push(std::function<void()> f, duration_t wait_before_execution) {
-    push(f, clock_t::now() + wait_before_execution);
+int EventQueue::num_workers() const {
+    return workers.empty() ? 1 : workers.size();
 }
 
 void EventQueue::stop() {
-    should_terminate = true;
-    event_thread.join();
+    {
+        std::lock_guard<decltype(queue_mutex)> lock(queue_mutex);
+        should_terminate = true;
+        work_ready.notify_all();
+    }
+    if (event_thread.joinable())
+        event_thread.join();
+    {
+        std::lock_guard<decltype(idle_mutex)> lock(idle_mutex);
+        tasks_ready.notify_all();
+    }
+    for (auto& worker: workers) {
+        if (worker->thread.joinable())
+            worker->thread.join();
+    }
+    for (auto& worker: workers) {
+        // destroyed at the end of the iteration, outside the lock.
+        ReadyRing dropped;
+        {
+            std::lock_guard<decltype(worker->deque_mutex)> lock(worker->deque_mutex);
+            std::swap(dropped, worker->tasks);
+        }
+        num_ready -= dropped.count;
+    }
 }
 
 // First run happens immediately, then every time_between_execution.
-std::shared_ptr<EQHandle> EventQueue::run_every(std::function<void()> f, duration_t time_between_execution) {
-    auto run_again = std::make_shared<bool>(true);
-    auto handle = std::make_shared<EQHandle>(run_again);
-
-    auto looper = std::make_shared<std::function<void ()>>();
-    *looper =
-            [this, looper, f, run_again, time_between_execution]() {
-        if(*run_again) {
-            f();
-            this->push(*looper, time_between_execution);
-        }
-    };
-    push(*looper);
-    return handle;
+std::shared_ptr<EQHandle> EventQueue::run_every(Task f,
+                                                duration_t time_between_execution,
+                                                Repeat repeat,
+                                                MissedTicks missed_ticks) {
+    std::lock_guard<decltype(queue_mutex)> lock(queue_mutex);
+    slot_t slot = acquire_slot();
+    Slot& s = slots[slot];
+    s.task = std::move(f);
+    s.state = Slot::PENDING;
+    s.repeating = true;
+    s.repeat = repeat;
+    s.missed_ticks = missed_ticks;
+    s.period = time_between_execution;
+    s.deadline = clock_t::now();
+    work->insert(slot, s.deadline);
+    work_ready.notify_all();
+    return std::make_shared<EQHandle>(link, timer_id(slot, s.generation));
 }
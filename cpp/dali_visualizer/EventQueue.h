@@ -1,63 +1,188 @@
 #ifndef DALI_VISUALIZER_EVENT_QUEUE_H
 #define DALI_VISUALIZER_EVENT_QUEUE_H
 
+#include <atomic>
 #include <chrono>
-#include <queue>
 #include <functional>
 #include <memory>
 #include <mutex>
 #include <thread>
 #include <condition_variable>
 
-struct EQHandle {
-    std::shared_ptr<bool> run_again;
+#include "dali_visualizer/Task.h"
+#include "dali_visualizer/TimerBackend.h"
+
+class EventQueue;
 
-    EQHandle(std::shared_ptr<bool> run_again);
+// Returned by run_every; stopping it (or dropping the last reference)
+// takes the task out of the queue right away. If it is running at that
+// moment the current run completes and no other one starts.
+struct EQHandle {
+    // shared between a queue and its handles; queue is cleared when the
+    // queue goes away, so handles may outlive it.
+    struct Link {
+        std::mutex mutex;
+        EventQueue* queue;
+    };
+    std::shared_ptr<Link> link;
+    TimerBackend::timer_id_t timer;
+
+    EQHandle(std::shared_ptr<Link> link, TimerBackend::timer_id_t timer);
     ~EQHandle();
     void stop();
 };
 
+// Runs tasks at (or after) a given time. With one worker (the default)
+// tasks run one after another on the event thread. With more, the event
+// thread hands due tasks out in deadline order to per-worker deques, and
+// idle workers steal from busy ones, so one slow task does not hold up
+// the rest.
+//
+// Tasks are kept in a pool of slots that only grows, and a repeating task
+// stays in its slot between runs, so once the pool is large enough pushing,
+// firing and re-arming tasks does not allocate.
 class EventQueue {
     public:
-        typedef std::chrono::high_resolution_clock clock_t;
+        typedef TimerBackend::clock_t clock_t;
         typedef clock_t::duration duration_t;
         typedef clock_t::time_point time_point_t;
+        typedef TimerBackend::timer_id_t timer_id_t;
 
         typedef std::shared_ptr<EQHandle> repeating_t;
-    private:
-        typedef std::tuple<time_point_t, std::function<void()>> work_item_t;
-        typedef std::function<bool(work_item_t, work_item_t)> comparator_t;
 
-        static bool cmp_work_item(work_item_t a, work_item_t b);
+        enum class Backend {
+            HEAP,        // binary heap, O(log n) push
+            TIMING_WHEEL // hierarchical timing wheel, O(1) push and cancel
+        };
+
+        // How run_every schedules the next run.
+        enum class Repeat {
+            FIXED_DELAY, // period after the previous run finished
+            FIXED_RATE   // at first run + k * period, without drift
+        };
+
+        // What a FIXED_RATE task does when runs fell behind by more than
+        // a period (slow task, busy queue).
+        enum class MissedTicks {
+            CATCH_UP, // one run per missed deadline, back to back
+            COALESCE  // a single run, then on to the next future deadline
+        };
+    private:
+        const Backend backend;
 
-        bool should_terminate = false;
+        std::atomic<bool> should_terminate;
         std::mutex queue_mutex;
         std::condition_variable work_ready;
 
-        std::priority_queue<work_item_t,
-                            std::vector<work_item_t>,
-                            comparator_t> work;
+        typedef TimerBackend::slot_t slot_t;
+        static const slot_t NO_SLOT = UINT32_MAX;
+
+        struct Slot {
+            enum State {FREE, PENDING, RUNNING};
+            Task task;
+            State state = FREE;
+            // bumped when the slot is freed, so stale timer ids miss.
+            uint32_t generation = 0;
+            // run_every tasks go back into the same slot after each run
+            // until cancelled.
+            bool repeating = false;
+            bool cancelled = false;
+            Repeat repeat;
+            MissedTicks missed_ticks;
+            duration_t period;
+            // when the current run was due.
+            time_point_t deadline;
+        };
+
+        std::unique_ptr<TimerBackend> work;
+        std::vector<Slot> slots;
+        std::vector<slot_t> free_slots;
+
+        // Tasks are never destroyed under queue_mutex, since they may
+        // hold the last reference to an EQHandle (whose stop locks it):
+        // callers take the task out of a slot before releasing it.
+        slot_t acquire_slot();
+        void release_slot(slot_t slot);
+        // puts task back into its slot for the next run; returns false
+        // (leaving task to the caller) if the slot was released instead.
+        bool rearm(slot_t slot, Task& task);
+        static timer_id_t timer_id(slot_t slot, uint32_t generation);
+
+        // due task handed to a worker; slot is NO_SLOT unless it repeats.
+        struct ReadyTask {
+            Task task;
+            slot_t slot;
+        };
+        // FIFO on a ring buffer that doubles when full.
+        struct ReadyRing {
+            std::vector<ReadyTask> items;
+            size_t head = 0;
+            size_t count = 0;
+
+            void push_back(ReadyTask item);
+            void pop_front(ReadyTask& item);
+        };
+        struct Worker {
+            std::mutex deque_mutex;
+            ReadyRing tasks;
+            std::thread thread;
+        };
+        // empty when tasks run on the event thread.
+        std::vector<std::unique_ptr<Worker>> workers;
+        size_t next_worker = 0;
+        std::mutex idle_mutex;
+        std::condition_variable tasks_ready;
+        // tasks sitting in worker deques.
+        std::atomic<size_t> num_ready;
+
         std::thread event_thread;
+        std::shared_ptr<EQHandle::Link> link;
 
         void run_thread_internal();
+        void dispatch(ReadyTask task);
+        // own deque first, then steal from the others; oldest first.
+        bool take_task(size_t worker, ReadyTask& task);
+        void run_worker(size_t worker);
+
+        // cancel, moving the task out into cancelled.
+        bool cancel(timer_id_t timer, Task& cancelled);
+        friend struct EQHandle;
 
     public:
-        // How long to sleep if queue is empty.
+        // How long to sleep if queue is empty. Only used by the heap
+        // backend; the timing wheel sleeps until its next deadline or
+        // until something is pushed.
         duration_t between_queue_checks = std::chrono::milliseconds(300);
 
-        EventQueue();
+        EventQueue(Backend backend=Backend::HEAP, int num_workers=1);
         ~EventQueue();
 
-        void push(std::function<void()> f);
+        timer_id_t push(Task f);
+
+        timer_id_t push(Task f, time_point_t when_to_execute);
+
+        timer_id_t push(Task f, duration_t wait_before_execution);
+
+        // Removes a pending task. Returns false if it already ran (or is
+        // running) or was cancelled before. A repeating task that is
+        // running finishes its current run and is not run again.
+        bool cancel(timer_id_t timer);
 
-        void push(std::function<void()> f, time_point_t when_to_execute);
+        // Number of pending tasks.
+        size_t size();
 
-        void push(std::function<void()> f, duration_t wait_before_execution);
+        int num_workers() const;
 
+        // Waits for the tasks that are running to finish. Tasks that
+        // have not started, due or not, are discarded; those already
+        // handed to workers are destroyed before stop returns.
         void stop();
 
         // First run happens immediately, then every time_between_execution.
-        std::shared_ptr<EQHandle> run_every(std::function<void()> f, duration_t time_between_execution);
+        std::shared_ptr<EQHandle> run_every(Task f,
+                                            duration_t time_between_execution,
+                                            Repeat repeat=Repeat::FIXED_DELAY,
+                                            MissedTicks missed_ticks=MissedTicks::COALESCE);
 };
 
 #endif
@@ -0,0 +1,251 @@
+#include "FeedLog.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace dali {
+    namespace visualizer {
+        const char* FEED_LOG_MAGIC = "DVL1";
+
+        static const size_t RECORD_HEADER_BYTES = 4 + 8;
+
+        static void fail(const std::string& what, const std::string& path) {
+            throw std::runtime_error("FeedLog: " + what + " " + path + ": " + strerror(errno));
+        }
+
+        static void write_u32(char* out, uint32_t value) {
+            for (int i = 0; i < 4; ++i) {
+                out[i] = (char)((value >> (8 * i)) & 0xff);
+            }
+        }
+
+        static void write_i64(char* out, int64_t value) {
+            for (int i = 0; i < 8; ++i) {
+                out[i] = (char)(((uint64_t)value >> (8 * i)) & 0xff);
+            }
+        }
+
+        static uint32_t read_u32(const char* in) {
+            uint32_t value = 0;
+            for (int i = 0; i < 4; ++i) {
+                value |= (uint32_t)(uint8_t)in[i] << (8 * i);
+            }
+            return value;
+        }
+
+        static int64_t read_i64(const char* in) {
+            uint64_t value = 0;
+            for (int i = 0; i < 8; ++i) {
+                value |= (uint64_t)(uint8_t)in[i] << (8 * i);
+            }
+            return (int64_t)value;
+        }
+
+        static std::string segment_name(int index) {
+            char name[32];
+            snprintf(name, sizeof(name), "feed-%08d.log", index);
+            return name;
+        }
+
+        // segment file names in directory, sorted.
+        static std::vector<std::string> list_segments(const std::string& directory) {
+            DIR* dir = opendir(directory.c_str());
+            if (dir == nullptr)
+                fail("cannot open", directory);
+            std::vector<std::string> names;
+            while (dirent* entry = readdir(dir)) {
+                std::string name = entry->d_name;
+                if (name.size() == 17 && name.compare(0, 5, "feed-") == 0 &&
+                        name.compare(13, 4, ".log") == 0) {
+                    names.push_back(name);
+                }
+            }
+            closedir(dir);
+            std::sort(names.begin(), names.end());
+            return names;
+        }
+
+        /* FeedLog */
+
+        FeedLog::FeedLog(std::string directory_, std::string channel_, size_t segment_bytes_) :
+                directory(directory_),
+                channel(channel_),
+                segment_bytes(segment_bytes_) {
+            auto existing = list_segments(directory);
+            if (!existing.empty())
+                segment_index = atoi(existing.back().c_str() + 5);
+        }
+
+        FeedLog::~FeedLog() {
+            std::lock_guard<std::mutex> guard(log_mutex);
+            close_segment();
+        }
+
+        void FeedLog::open_segment(size_t min_bytes) {
+            std::string path;
+            // another log writing to the same directory may have taken
+            // the next index already; never reuse its segment.
+            do {
+                segment_index++;
+                path = directory + "/" + segment_name(segment_index);
+                fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+            } while (fd < 0 && errno == EEXIST);
+            if (fd < 0)
+                fail("cannot create", path);
+            size_t header_bytes = 8 + channel.size();
+            mapping_size = std::max(segment_bytes, header_bytes + min_bytes + RECORD_HEADER_BYTES);
+            // reserve the blocks now: writing through the mapping into a
+            // hole on a full disk would be a SIGBUS instead of an error.
+            int err = posix_fallocate(fd, 0, mapping_size);
+            if (err != 0) {
+                close(fd);
+                fd = -1;
+                unlink(path.c_str());
+                errno = err;
+                fail("cannot size", path);
+            }
+            void* addr = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (addr == MAP_FAILED)
+                fail("cannot map", path);
+            mapping = static_cast<char*>(addr);
+            memcpy(mapping, FEED_LOG_MAGIC, 4);
+            write_u32(mapping + 4, channel.size());
+            memcpy(mapping + 8, channel.data(), channel.size());
+            used = header_bytes;
+        }
+
+        void FeedLog::close_segment() {
+            if (mapping == nullptr)
+                return;
+            munmap(mapping, mapping_size);
+            // the rest of the file is zeros; drop it.
+            if (ftruncate(fd, used) != 0) {
+                // the reader stops at the first zero length anyway.
+            }
+            close(fd);
+            mapping = nullptr;
+            fd = -1;
+        }
+
+        void FeedLog::append(const std::string& payload) {
+            append(payload.data(), payload.size(), clock_t::now());
+        }
+
+        void FeedLog::append(const char* data, size_t size, clock_t::time_point when) {
+            if (size == 0)
+                return;
+            std::lock_guard<std::mutex> guard(log_mutex);
+            if (mapping == nullptr || used + RECORD_HEADER_BYTES + size > mapping_size) {
+                close_segment();
+                open_segment(size);
+            }
+            char* out = mapping + used;
+            write_u32(out, size);
+            write_i64(out + 4, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    when.time_since_epoch()).count());
+            memcpy(out + RECORD_HEADER_BYTES, data, size);
+            used += RECORD_HEADER_BYTES + size;
+        }
+
+        void FeedLog::flush() {
+            std::lock_guard<std::mutex> guard(log_mutex);
+            if (mapping != nullptr)
+                msync(mapping, used, MS_ASYNC);
+        }
+
+        /* FeedLogReader */
+
+        FeedLogReader::FeedLogReader(std::string directory) {
+            try {
+                for (auto& name: list_segments(directory)) {
+                    open_segment(directory + "/" + name);
+                }
+            } catch (...) {
+                for (auto& segment: segments) {
+                    munmap(const_cast<char*>(segment.mapping), segment.mapping_size);
+                }
+                throw;
+            }
+            for (size_t i = 0; i < segments.size(); ++i) {
+                push_head(i);
+            }
+        }
+
+        FeedLogReader::~FeedLogReader() {
+            for (auto& segment: segments) {
+                munmap(const_cast<char*>(segment.mapping), segment.mapping_size);
+            }
+        }
+
+        void FeedLogReader::open_segment(const std::string& path) {
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                fail("cannot open", path);
+            struct stat info;
+            if (fstat(fd, &info) != 0) {
+                int err = errno;
+                close(fd);
+                errno = err;
+                fail("cannot stat", path);
+            }
+            size_t mapping_size = info.st_size;
+            if (mapping_size < 8) {
+                close(fd);
+                return;
+            }
+            // the mapping outlives the descriptor, so a long log does not
+            // run into the open file limit.
+            void* addr = mmap(nullptr, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+            int err = errno;
+            close(fd);
+            if (addr == MAP_FAILED) {
+                errno = err;
+                fail("cannot map", path);
+            }
+            const char* mapping = static_cast<const char*>(addr);
+            uint32_t channel_size = read_u32(mapping + 4);
+            if (memcmp(mapping, FEED_LOG_MAGIC, 4) != 0 || 8 + channel_size > mapping_size) {
+                munmap(addr, mapping_size);
+                return;
+            }
+            segments.push_back(Segment{std::string(mapping + 8, channel_size),
+                                       mapping, mapping_size, 8 + channel_size});
+        }
+
+        void FeedLogReader::push_head(size_t index) {
+            const Segment& segment = segments[index];
+            if (segment.position + RECORD_HEADER_BYTES > segment.mapping_size)
+                return;
+            uint32_t size = read_u32(segment.mapping + segment.position);
+            if (size == 0 || segment.position + RECORD_HEADER_BYTES + size > segment.mapping_size)
+                return;
+            heads.push(head_t(read_i64(segment.mapping + segment.position + 4), index));
+        }
+
+        bool FeedLogReader::next(Record& record) {
+            if (heads.empty())
+                return false;
+            head_t head = heads.top();
+            heads.pop();
+            Segment& segment = segments[head.second];
+            record.when = FeedLog::clock_t::time_point(
+                    std::chrono::duration_cast<FeedLog::clock_t::duration>(
+                        std::chrono::nanoseconds(head.first)));
+            record.channel = &segment.channel;
+            record.size = read_u32(segment.mapping + segment.position);
+            record.data = segment.mapping + segment.position + RECORD_HEADER_BYTES;
+            segment.position += RECORD_HEADER_BYTES + record.size;
+            push_head(head.second);
+            return true;
+        }
+    }
+}
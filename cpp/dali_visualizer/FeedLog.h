@@ -0,0 +1,105 @@
+#ifndef DALI_VISUALIZER_FEED_LOG_H
+#define DALI_VISUALIZER_FEED_LOG_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <vector>
+
+namespace dali {
+    namespace visualizer {
+        // On-disk layout shared by FeedLog and FeedLogReader. A log is a
+        // directory of segments feed-00000000.log, feed-00000001.log, ..
+        // each starting with
+        //
+        //     "DVL1" | u32 channel length | channel
+        //
+        // followed by records
+        //
+        //     u32 payload length | i64 system_clock ns since epoch | payload
+        //
+        // all little endian. A zero length (the unwritten tail of a
+        // segment) ends the segment.
+        extern const char* FEED_LOG_MAGIC;
+
+        // Appends published messages to memory-mapped segments of
+        // segment_bytes each, rotating to a new segment when one fills
+        // up. Appends are a memcpy into the mapping; the kernel writes
+        // the pages back in the background.
+        class FeedLog {
+            public:
+                typedef std::chrono::system_clock clock_t;
+            private:
+                const std::string directory;
+                const std::string channel;
+                const size_t segment_bytes;
+
+                std::mutex log_mutex;
+                int segment_index = -1;
+                int fd = -1;
+                char* mapping = nullptr;
+                size_t mapping_size = 0;
+                size_t used = 0;
+
+                void open_segment(size_t min_bytes);
+                // truncates the file to what was written.
+                void close_segment();
+            public:
+                // Starts after the last segment already in directory, which
+                // has to exist. Segments are never overwritten, so several
+                // logs may share a directory (their segments interleave).
+                // Throws std::runtime_error on I/O errors.
+                FeedLog(std::string directory, std::string channel, size_t segment_bytes=64 << 20);
+                ~FeedLog();
+
+                void append(const std::string& payload);
+                void append(const char* data, size_t size, clock_t::time_point when);
+
+                // Schedules dirty pages to be written back.
+                void flush();
+        };
+
+        // Reads the records of a log directory in time order. The
+        // segments of logs sharing the directory are merged, so records
+        // of different writers come out interleaved as they were written.
+        class FeedLogReader {
+            public:
+                struct Record {
+                    FeedLog::clock_t::time_point when;
+                    // channel of the segment the record is in.
+                    const std::string* channel;
+                    const char* data;
+                    size_t size;
+                };
+            private:
+                struct Segment {
+                    std::string channel;
+                    const char* mapping;
+                    size_t mapping_size;
+                    size_t position;
+                };
+                std::vector<Segment> segments;
+                // (time of the next record, segment) of every segment that
+                // has records left, earliest first.
+                typedef std::pair<int64_t, size_t> head_t;
+                std::priority_queue<head_t, std::vector<head_t>, std::greater<head_t>> heads;
+
+                void open_segment(const std::string& path);
+                // queues segment's next record, if it has one.
+                void push_head(size_t segment);
+            public:
+                // Throws std::runtime_error if directory cannot be read.
+                FeedLogReader(std::string directory);
+                ~FeedLogReader();
+
+                // Record data stays valid until the next call. Returns
+                // false at the end of the log.
+                bool next(Record& record);
+        };
+    }
+}
+
+#endif
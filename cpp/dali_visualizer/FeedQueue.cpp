@@ -0,0 +1,104 @@
+#include "FeedQueue.h"
+
+namespace dali {
+    namespace visualizer {
+        FeedQueue::~FeedQueue() {
+        }
+
+        /* SharedFeedQueue */
+
+        SharedFeedQueue::SharedFeedQueue(size_t capacity_, OverflowPolicy policy_) :
+                capacity(capacity_ > 0 ? capacity_ : 1),
+                policy(policy_),
+                dropped(0) {
+        }
+
+        bool SharedFeedQueue::push(message_t message) {
+            bool lost_message = false;
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                if (closed) {
+                    dropped++;
+                    return false;
+                }
+                if (messages.size() >= capacity) {
+                    switch (policy) {
+                        case OverflowPolicy::DROP_NEWEST:
+                            dropped++;
+                            return false;
+                        case OverflowPolicy::DROP_OLDEST:
+                            messages.pop_front();
+                            dropped++;
+                            lost_message = true;
+                            break;
+                        case OverflowPolicy::BLOCK:
+                            not_full.wait(lock, [this]() {
+                                return closed || messages.size() < capacity;
+                            });
+                            if (closed) {
+                                dropped++;
+                                return false;
+                            }
+                            break;
+                    }
+                }
+                message.enqueued = clock_t::now();
+                messages.push_back(std::move(message));
+            }
+            not_empty.notify_one();
+            return !lost_message;
+        }
+
+        bool SharedFeedQueue::pop(message_t& message) {
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                not_empty.wait(lock, [this]() {
+                    return closed || !messages.empty();
+                });
+                if (messages.empty())
+                    return false;
+                message = std::move(messages.front());
+                messages.pop_front();
+            }
+            not_full.notify_one();
+            return true;
+        }
+
+        bool SharedFeedQueue::pop_until(message_t& message, clock_t::time_point deadline) {
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                not_empty.wait_until(lock, deadline, [this]() {
+                    return closed || !messages.empty();
+                });
+                if (messages.empty())
+                    return false;
+                message = std::move(messages.front());
+                messages.pop_front();
+            }
+            not_full.notify_one();
+            return true;
+        }
+
+        void SharedFeedQueue::close() {
+            {
+                std::lock_guard<std::mutex> lock(queue_mutex);
+                closed = true;
+            }
+            not_empty.notify_all();
+            not_full.notify_all();
+        }
+
+        size_t SharedFeedQueue::size() {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            return messages.size();
+        }
+
+        uint64_t SharedFeedQueue::num_dropped() const {
+            return dropped.load();
+        }
+
+        size_t SharedFeedQueue::max_size() {
+            return capacity;
+        }
+    }
+}
@@ -0,0 +1,104 @@
+#ifndef DALI_VISUALIZER_FEED_QUEUE_H
+#define DALI_VISUALIZER_FEED_QUEUE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <json11.hpp>
+
+namespace dali {
+    namespace visualizer {
+        // What to do when a message arrives and the queue is full.
+        enum class OverflowPolicy {
+            DROP_OLDEST, // evict the oldest pending message
+            DROP_NEWEST, // discard the incoming message
+            BLOCK        // wait until the publisher makes room
+        };
+
+        // A message waiting to be published: either a Json object that the
+        // publisher thread serializes, or a payload the caller already
+        // serialized (payload is non-empty).
+        struct FeedMessage {
+            json11::Json obj;
+            std::string payload;
+            // set by FeedQueue::push.
+            std::chrono::steady_clock::time_point enqueued;
+
+            FeedMessage() = default;
+            FeedMessage(json11::Json obj_, std::string payload_) :
+                    obj(std::move(obj_)),
+                    payload(std::move(payload_)) {
+            }
+        };
+
+        // How producer threads share the feed queue, see
+        // Visualizer::enable_async_feed.
+        enum class FeedSharding {
+            SHARED,    // one queue behind one lock (SharedFeedQueue)
+            PER_THREAD // a buffer per producer thread (ShardedFeedQueue)
+        };
+
+        // Bounded multi-producer queue between feed() and the publisher
+        // thread, which is its only consumer. Producers never block
+        // unless the policy is BLOCK.
+        class FeedQueue {
+            public:
+                typedef FeedMessage message_t;
+                typedef std::chrono::steady_clock clock_t;
+
+                virtual ~FeedQueue();
+
+                // Returns false if a message (the incoming or an evicted
+                // one) had to be dropped.
+                virtual bool push(message_t message) = 0;
+
+                // Blocks until a message is available. Returns false once
+                // the queue is closed and fully drained.
+                virtual bool pop(message_t& message) = 0;
+
+                // Like pop, but gives up at deadline. Returns false if no
+                // message was popped.
+                virtual bool pop_until(message_t& message, clock_t::time_point deadline) = 0;
+
+                // Wakes up everyone; pending messages can still be popped.
+                virtual void close() = 0;
+
+                virtual size_t size() = 0;
+                virtual uint64_t num_dropped() const = 0;
+
+                virtual size_t max_size() = 0;
+        };
+
+        // Every producer pushes into one deque under one mutex.
+        class SharedFeedQueue : public FeedQueue {
+            private:
+                const size_t capacity;
+                const OverflowPolicy policy;
+
+                bool closed = false;
+                std::deque<message_t> messages;
+                std::mutex queue_mutex;
+                std::condition_variable not_empty;
+                std::condition_variable not_full;
+
+                std::atomic<uint64_t> dropped;
+            public:
+                SharedFeedQueue(size_t capacity, OverflowPolicy policy);
+
+                virtual bool push(message_t message) override;
+                virtual bool pop(message_t& message) override;
+                virtual bool pop_until(message_t& message, clock_t::time_point deadline) override;
+                virtual void close() override;
+                virtual size_t size() override;
+                virtual uint64_t num_dropped() const override;
+                virtual size_t max_size() override;
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,55 @@
+#include "FeedThrottle.h"
+
+#include <algorithm>
+
+namespace dali {
+    namespace visualizer {
+        const int FeedThrottle::MAX_SLOWDOWN;
+
+        FeedThrottle::FeedThrottle() : next_run_ns(INT64_MIN) {
+        }
+
+        // the queue is filling up, or messages take more than half an
+        // interval to get out.
+        bool FeedThrottle::congested(const Load& load, clock_t::duration interval) {
+            return load.backlog > 0.5 || load.publish_latency * 2 > interval;
+        }
+
+        bool FeedThrottle::idle(const Load& load, clock_t::duration interval) {
+            return load.backlog < 0.1 && load.publish_latency * 8 < interval;
+        }
+
+        bool FeedThrottle::try_run(clock_t::duration interval, ThrottleMode mode, const Load& load) {
+            auto now = clock_t::now();
+            auto now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    now.time_since_epoch()).count();
+            // the slowdown never goes below 1, so as long as callers pass
+            // the same interval this never turns away a due run.
+            if (now_ns < next_run_ns.load(std::memory_order_relaxed))
+                return false;
+            std::lock_guard<std::mutex> guard(throttle_mutex);
+            auto stretched = std::chrono::duration_cast<clock_t::duration>(interval * slowdown);
+            if (has_run && now - last_run < stretched)
+                return false;
+            if (mode == ThrottleMode::ADAPTIVE) {
+                if (congested(load, interval)) {
+                    slowdown = std::min<double>(MAX_SLOWDOWN, slowdown * 2);
+                } else if (idle(load, interval)) {
+                    slowdown = std::max(1.0, slowdown * 0.75);
+                }
+            } else {
+                slowdown = 1.0;
+            }
+            last_run = now;
+            has_run = true;
+            next_run_ns.store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    (now + interval).time_since_epoch()).count(), std::memory_order_relaxed);
+            return true;
+        }
+
+        FeedThrottle::clock_t::duration FeedThrottle::effective_interval(clock_t::duration interval) {
+            std::lock_guard<std::mutex> guard(throttle_mutex);
+            return std::chrono::duration_cast<clock_t::duration>(interval * slowdown);
+        }
+    }
+}
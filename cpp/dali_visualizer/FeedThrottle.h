@@ -0,0 +1,60 @@
+#ifndef DALI_VISUALIZER_FEED_THROTTLE_H
+#define DALI_VISUALIZER_FEED_THROTTLE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+namespace dali {
+    namespace visualizer {
+        enum class ThrottleMode {
+            FIXED,   // at most once per interval
+            ADAPTIVE // interval stretched while the publisher falls behind
+        };
+
+        // Rate limit behind one throttled_feed key. In ADAPTIVE mode the
+        // requested interval is multiplied by a slowdown factor that
+        // doubles (up to MAX_SLOWDOWN) each time the link is found
+        // congested when a run comes due, and decays back to 1 while it
+        // is idle.
+        class FeedThrottle {
+            public:
+                typedef std::chrono::high_resolution_clock clock_t;
+
+                // What the publisher looks like right now.
+                struct Load {
+                    // fraction of the feed queue in use, 0 when feeding
+                    // synchronously.
+                    double backlog;
+                    // recent time from feed to the message being handed
+                    // to redis.
+                    clock_t::duration publish_latency;
+                };
+
+                static const int MAX_SLOWDOWN = 64;
+            private:
+                std::mutex throttle_mutex;
+                bool has_run = false;
+                clock_t::time_point last_run;
+                double slowdown = 1.0;
+                // earliest time (since clock_t's epoch) the next run can
+                // be due, so calls in between return without the lock.
+                std::atomic<int64_t> next_run_ns;
+
+                static bool congested(const Load& load, clock_t::duration interval);
+                static bool idle(const Load& load, clock_t::duration interval);
+            public:
+                FeedThrottle();
+
+                // Returns true, and counts it as a run, if interval (as
+                // adapted) has passed since the last run.
+                bool try_run(clock_t::duration interval, ThrottleMode mode, const Load& load);
+
+                // interval as currently stretched by the slowdown factor.
+                clock_t::duration effective_interval(clock_t::duration interval);
+        };
+    }
+}
+
+#endif
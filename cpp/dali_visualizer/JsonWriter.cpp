@@ -0,0 +1,696 @@
+#include "JsonWriter.h"
+
+#include "dali_visualizer/EventQueue.h"
+#include "dali_visualizer/visualizer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+using json11::Json;
+
+namespace dali {
+    namespace visualizer {
+        static std::mutex pool_mutex;
+        // the calling thread serializes too, so one helper fewer than cores.
+        static int pool_threads = (int)std::thread::hardware_concurrency() - 1;
+        static std::shared_ptr<EventQueue> pool;
+
+        // without helpers, splitting the work up is pure overhead.
+        static std::atomic<size_t> parallel_threshold(pool_threads > 0 ? 64 << 10 : 0);
+
+        void set_parallel_serialization(size_t threshold_bytes, int num_threads) {
+            std::lock_guard<std::mutex> guard(pool_mutex);
+            if (num_threads >= 0 && pool == nullptr)
+                pool_threads = num_threads;
+            parallel_threshold.store(pool_threads > 0 ? threshold_bytes : 0);
+        }
+
+        static std::shared_ptr<EventQueue> serialization_pool() {
+            std::lock_guard<std::mutex> guard(pool_mutex);
+            if (pool == nullptr && pool_threads > 0)
+                pool = std::make_shared<EventQueue>(EventQueue::Backend::HEAP, pool_threads);
+            return pool;
+        }
+
+        /* NumberFormat */
+
+        NumberFormat::NumberFormat(int precision_, bool keep_float32_) :
+                precision(precision_),
+                keep_float32(keep_float32_) {
+        }
+
+        // exact powers of ten as doubles.
+        static const double powers_of_ten[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+
+        // number * 10^exponent, within a few ulps.
+        static double scale(double number, int exponent) {
+            while (exponent > 22) {
+                number *= 1e22;
+                exponent -= 22;
+            }
+            while (exponent < -22) {
+                number /= 1e22;
+                exponent += 22;
+            }
+            return exponent >= 0 ? number * powers_of_ten[exponent] :
+                                   number / powers_of_ten[-exponent];
+        }
+
+        // e such that 10^e <= number < 10^(e + 1), for positive number.
+        static int decimal_exponent(double number) {
+            int binary_exponent;
+            std::frexp(number, &binary_exponent);
+            // log10(2), may be one too low.
+            int exponent = (int)std::floor((binary_exponent - 1) * 0.30102999566398120);
+            if (scale(number, -exponent) >= 10)
+                exponent++;
+            return exponent;
+        }
+
+        // digits the double arithmetic below rounds correctly (or
+        // notices it may not).
+        static const int MAX_FAST_PRECISION = 12;
+
+        // Rounds positive number to precision (at most
+        // MAX_FAST_PRECISION) significant digits: number ~ digits *
+        // 10^exponent. Returns false if scaling errs by too much to tell
+        // which way the last digit rounds (near a tie), so the result may
+        // differ from %.*g.
+        static bool round_to_precision(double number, int precision, uint64_t& digits, int& exponent) {
+            exponent = decimal_exponent(number) - precision + 1;
+            double unrounded = scale(number, -exponent);
+            // scale rounds a handful of times, each within half an ulp.
+            double error = unrounded * 1e-15;
+            double fraction = unrounded - std::floor(unrounded);
+            if (std::fabs(fraction - 0.5) <= error)
+                return false;
+            double scaled = std::nearbyint(unrounded);
+            if (scaled >= powers_of_ten[precision]) {
+                // rounded up to one more digit, e.g. 9.96 to 10.0
+                scaled = std::nearbyint(scaled / 10);
+                exponent++;
+            }
+            digits = (uint64_t)scaled;
+            return true;
+        }
+
+        // Fewest digits that read back as number, a positive float32:
+        // the first digit count for which some digits * 10^exponent
+        // falls between number and its neighbours. The neighbours'
+        // midpoints are exact as doubles and scaling them errs by a few
+        // double ulps, far less than the margin kept from them.
+        static void shortest_float32(float number, uint64_t& digits, int& exponent) {
+            int binary_exponent;
+            float fraction = std::frexp(number, &binary_exponent);
+            double value = number;
+            double ulp = std::ldexp(1.0, std::max(binary_exponent - 24, -149));
+            // below a power of two the next float is closer.
+            double ulp_below = fraction == 0.5f && binary_exponent - 25 >= -149 ? ulp / 2 : ulp;
+
+            // everything at 9 digits, shifted right for fewer.
+            int last = decimal_exponent(value) - 8;
+            double scaled_value = scale(value, -last);
+            double scaled_low = scale(value - ulp_below / 2, -last);
+            double scaled_high = scale(value + ulp / 2, -last);
+            double margin = (scaled_high - scaled_low) * 1e-6;
+            scaled_low += margin;
+            scaled_high -= margin;
+            for (int precision = 1; precision <= 9; ++precision) {
+                double shift = powers_of_ten[9 - precision];
+                double scaled = scaled_value / shift;
+                double below = std::floor(scaled);
+                double above = below + 1;
+                bool below_fits = below * shift > scaled_low;
+                bool above_fits = above * shift < scaled_high;
+                if (below_fits && (!above_fits || scaled - below <= above - scaled)) {
+                    digits = (uint64_t)below;
+                    exponent = last + 9 - precision;
+                    return;
+                }
+                if (above_fits) {
+                    digits = (uint64_t)above;
+                    exponent = last + 9 - precision;
+                    return;
+                }
+            }
+            // 9 digits always fit; in case rounding says otherwise. Any
+            // 9 digits within half a unit read back the same.
+            exponent = last;
+            digits = (uint64_t)std::nearbyint(scaled_value);
+        }
+
+        /* FragmentCache */
+
+        FragmentCache::FragmentCache(const FragmentCache&) {
+        }
+
+        FragmentCache& FragmentCache::operator=(const FragmentCache&) {
+            std::lock_guard<std::mutex> guard(cache_mutex);
+            settings = -1;
+            text.clear();
+            blocks.clear();
+            return *this;
+        }
+
+        bool FragmentCache::splice_into(uint64_t version_, int settings_,
+                                        std::string& text_out, std::string& blocks_out) {
+            std::lock_guard<std::mutex> guard(cache_mutex);
+            if (version_ != version || settings_ != settings)
+                return false;
+            text_out += text;
+            blocks_out += blocks;
+            return true;
+        }
+
+        void FragmentCache::store(uint64_t version_, int settings_,
+                                  const char* text_, size_t text_length,
+                                  const char* blocks_, size_t blocks_length) {
+            std::lock_guard<std::mutex> guard(cache_mutex);
+            version = version_;
+            settings = settings_;
+            text.assign(text_, text_length);
+            blocks.assign(blocks_, blocks_length);
+        }
+
+        /* JsonWriter */
+
+        JsonWriter::JsonWriter() {
+            has_elements.reserve(16);
+        }
+
+        void JsonWriter::clear() {
+            out.clear();
+            has_elements.clear();
+            after_key = false;
+            binary_blocks.clear();
+            child_depth = 0;
+        }
+
+        void JsonWriter::set_binary_arrays(bool enabled) {
+            binary_arrays = enabled;
+        }
+
+        const std::string& JsonWriter::blocks() const {
+            return binary_blocks;
+        }
+
+        void JsonWriter::set_fragment_cache(bool enabled) {
+            fragment_cache = enabled;
+        }
+
+        void JsonWriter::set_number_format(NumberFormat format_) {
+            format = format_;
+        }
+
+        const NumberFormat& JsonWriter::number_format() const {
+            return format;
+        }
+
+        int JsonWriter::settings_key() const {
+            return (binary_arrays ? 1 : 0) | (format.keep_float32 ? 2 : 0) | (format.precision << 2);
+        }
+
+        void JsonWriter::record_children(std::vector<ChildSpan>* spans) {
+            child_spans = spans;
+        }
+
+        const std::string& JsonWriter::str() const {
+            return out;
+        }
+
+        size_t JsonWriter::size() const {
+            return out.size();
+        }
+
+        void JsonWriter::separate() {
+            if (after_key) {
+                after_key = false;
+                return;
+            }
+            if (!has_elements.empty()) {
+                if (has_elements.back()) {
+                    out += ',';
+                } else {
+                    has_elements.back() = true;
+                }
+            }
+        }
+
+        // Same escaping rules as json11::Json::dump.
+        void JsonWriter::write_string(const char* str, size_t length) {
+            out += '"';
+            size_t clean_start = 0;
+            for (size_t i = 0; i < length; ++i) {
+                const uint8_t ch = static_cast<uint8_t>(str[i]);
+                const char* escaped = nullptr;
+                char buf[8];
+                size_t skip = 0;
+                if (ch == '\\') {
+                    escaped = "\\\\";
+                } else if (ch == '"') {
+                    escaped = "\\\"";
+                } else if (ch == '\b') {
+                    escaped = "\\b";
+                } else if (ch == '\f') {
+                    escaped = "\\f";
+                } else if (ch == '\n') {
+                    escaped = "\\n";
+                } else if (ch == '\r') {
+                    escaped = "\\r";
+                } else if (ch == '\t') {
+                    escaped = "\\t";
+                } else if (ch <= 0x1f) {
+                    snprintf(buf, sizeof buf, "\\u%04x", ch);
+                    escaped = buf;
+                } else if (ch == 0xe2 && i + 2 < length &&
+                           static_cast<uint8_t>(str[i + 1]) == 0x80 &&
+                           (static_cast<uint8_t>(str[i + 2]) == 0xa8 ||
+                            static_cast<uint8_t>(str[i + 2]) == 0xa9)) {
+                    escaped = static_cast<uint8_t>(str[i + 2]) == 0xa8 ? "\\u2028" : "\\u2029";
+                    skip = 2;
+                }
+                if (escaped != nullptr) {
+                    out.append(str + clean_start, i - clean_start);
+                    out += escaped;
+                    i += skip;
+                    clean_start = i + 1;
+                }
+            }
+            out.append(str + clean_start, length - clean_start);
+            out += '"';
+        }
+
+        void JsonWriter::write_number(double number, bool float32) {
+            if (!std::isfinite(number)) {
+                out += "null";
+                return;
+            }
+            int precision = std::min(std::max(format.precision, 0), 17);
+            if (float32 && format.keep_float32) {
+                precision = precision == 0 ? 0 : std::min(precision, 9);
+            } else if (precision == 0) {
+                precision = 17;
+            }
+
+            bool negative = std::signbit(number);
+            double magnitude = std::fabs(number);
+            // whole numbers (counters, ids, versions) stay exact whatever
+            // the precision, as %.17g would write them.
+            if (magnitude < 1e15 && magnitude == std::floor(magnitude)) {
+                char buf[24];
+                char* end = buf + sizeof buf;
+                char* p = end;
+                uint64_t whole = (uint64_t)magnitude;
+                do {
+                    *--p = (char)('0' + whole % 10);
+                    whole /= 10;
+                } while (whole > 0);
+                if (negative) *--p = '-';
+                out.append(p, end - p);
+                return;
+            }
+            uint64_t digits;
+            int exponent;
+            if (precision == 0) {
+                shortest_float32((float)magnitude, digits, exponent);
+                write_decimal(negative, digits, exponent, 17);
+            } else if (precision <= MAX_FAST_PRECISION &&
+                       round_to_precision(magnitude, precision, digits, exponent)) {
+                write_decimal(negative, digits, exponent, precision);
+            } else {
+                char buf[32];
+                int length = snprintf(buf, sizeof buf, "%.*g", precision, number);
+                out.append(buf, length);
+            }
+        }
+
+        // digits is positive.
+        void JsonWriter::write_decimal(bool negative, uint64_t digits, int exponent, int fixed_limit) {
+            while (digits % 10 == 0) {
+                digits /= 10;
+                exponent++;
+            }
+            char digit_buf[24];
+            char* d = digit_buf + sizeof digit_buf;
+            int length = 0;
+            do {
+                *--d = (char)('0' + digits % 10);
+                digits /= 10;
+                length++;
+            } while (digits > 0);
+
+            char buf[48];
+            char* p = buf;
+            if (negative) *p++ = '-';
+            // position of the leading digit, as in d.ddd * 10^leading.
+            int leading = exponent + length - 1;
+            if (leading < -4 || leading >= fixed_limit) {
+                *p++ = d[0];
+                if (length > 1) {
+                    *p++ = '.';
+                    memcpy(p, d + 1, length - 1);
+                    p += length - 1;
+                }
+                p += snprintf(p, buf + sizeof buf - p, "e%c%02d", leading < 0 ? '-' : '+', std::abs(leading));
+            } else if (exponent >= 0) {
+                memcpy(p, d, length);
+                p += length;
+                for (int i = 0; i < exponent; ++i) *p++ = '0';
+            } else if (leading >= 0) {
+                memcpy(p, d, leading + 1);
+                p += leading + 1;
+                *p++ = '.';
+                memcpy(p, d + leading + 1, length - leading - 1);
+                p += length - leading - 1;
+            } else {
+                *p++ = '0';
+                *p++ = '.';
+                for (int i = 0; i < -leading - 1; ++i) *p++ = '0';
+                memcpy(p, d, length);
+                p += length;
+            }
+            out.append(buf, p - buf);
+        }
+
+        JsonWriter& JsonWriter::begin_object() {
+            separate();
+            out += '{';
+            has_elements.push_back(false);
+            return *this;
+        }
+
+        JsonWriter& JsonWriter::end_object() {
+            out += '}';
+            has_elements.pop_back();
+            return *this;
+        }
+
+        JsonWriter& JsonWriter::begin_array() {
+            separate();
+            out += '[';
+            has_elements.push_back(false);
+            return *this;
+        }
+
+        JsonWriter& JsonWriter::end_array() {
+            out += ']';
+            has_elements.pop_back();
+            return *this;
+        }
+
+        JsonWriter& JsonWriter::key(const char* name) {
+            separate();
+            write_string(name, strlen(name));
+            out += ':';
+            after_key = true;
+            return *this;
+        }
+
+        JsonWriter& JsonWriter::key(const std::string& name) {
+            separate();
+            write_string(name.data(), name.size());
+            out += ':';
+            after_key = true;
+            return *this;
+        }
+
+        JsonWriter& JsonWriter::value(const char* str) {
+            separate();
+            write_string(str, strlen(str));
+            return *this;
+        }
+
+        JsonWriter& JsonWriter::value(const std::string& str) {
+            separate();
+            write_string(str.data(), str.size());
+            return *this;
+        }
+
+        JsonWriter& JsonWriter::value(double number) {
+            separate();
+            write_number(number);
+            return *this;
+        }
+
+        JsonWriter& JsonWriter::value(float number) {
+            separate();
+            write_number(number, true);
+            return *this;
+        }
+
+        JsonWriter& JsonWriter::value(int number) {
+            separate();
+            char buf[16];
+            int length = snprintf(buf, sizeof buf, "%d", number);
+            out.append(buf, length);
+            return *this;
+        }
+
+        JsonWriter& JsonWriter::value(bool boolean) {
+            separate();
+            out += boolean ? "true" : "false";
+            return *this;
+        }
+
+        JsonWriter& JsonWriter::value(const Json& json) {
+            switch (json.type()) {
+                case Json::NUL:
+                    return null();
+                case Json::NUMBER:
+                    return value(json.number_value());
+                case Json::BOOL:
+                    return value(json.bool_value());
+                case Json::STRING:
+                    return value(json.string_value());
+                case Json::ARRAY:
+                    begin_array();
+                    for (auto& item: json.array_items()) {
+                        value(item);
+                    }
+                    return end_array();
+                case Json::OBJECT:
+                    begin_object();
+                    for (auto& kv: json.object_items()) {
+                        key(kv.first);
+                        value(kv.second);
+                    }
+                    return end_object();
+            }
+            return *this;
+        }
+
+        JsonWriter& JsonWriter::null() {
+            separate();
+            out += "null";
+            return *this;
+        }
+
+        template<typename R>
+        JsonWriter& JsonWriter::number_array(const R* data, size_t length) {
+            if (binary_arrays) {
+                separate();
+                char buf[32];
+                int header_length = snprintf(buf, sizeof buf, "{\"__f32__\":%zu}", length);
+                out.append(buf, header_length);
+
+                size_t offset = binary_blocks.size();
+                binary_blocks.resize(offset + 4 * length);
+                char* dest = &binary_blocks[offset];
+                for (size_t i = 0; i < length; ++i) {
+                    float number = data[i];
+                    uint32_t bits;
+                    memcpy(&bits, &number, 4);
+                    dest[4 * i]     = static_cast<char>(bits & 0xff);
+                    dest[4 * i + 1] = static_cast<char>((bits >> 8) & 0xff);
+                    dest[4 * i + 2] = static_cast<char>((bits >> 16) & 0xff);
+                    dest[4 * i + 3] = static_cast<char>((bits >> 24) & 0xff);
+                }
+                return *this;
+            }
+            begin_array();
+            for (size_t i = 0; i < length; ++i) {
+                if (i > 0) out += ',';
+                write_number(data[i], std::is_same<R, float>::value);
+            }
+            return end_array();
+        }
+
+        template JsonWriter& JsonWriter::number_array(const float*, size_t);
+        template JsonWriter& JsonWriter::number_array(const double*, size_t);
+
+        JsonWriter& JsonWriter::string_array(const std::vector<std::string>& strings) {
+            begin_array();
+            for (auto& str: strings) {
+                value(str);
+            }
+            return end_array();
+        }
+
+        JsonWriter& JsonWriter::int_array(const std::vector<int>& numbers) {
+            begin_array();
+            for (int number: numbers) {
+                value(number);
+            }
+            return end_array();
+        }
+
+        void JsonWriter::write_child(Visualizable& visualizable) {
+            uint64_t version = fragment_cache ? visualizable.content_version() : Visualizable::VOLATILE;
+            if (version == Visualizable::VOLATILE) {
+                visualizable.write_json(*this);
+                return;
+            }
+            if (visualizable.fragment_cache.splice_into(version, settings_key(), out, binary_blocks)) {
+                after_key = false;
+                return;
+            }
+            size_t text_begin = out.size();
+            size_t blocks_begin = binary_blocks.size();
+            visualizable.write_json(*this);
+            visualizable.fragment_cache.store(version, settings_key(),
+                    out.data() + text_begin, out.size() - text_begin,
+                    binary_blocks.data() + blocks_begin, binary_blocks.size() - blocks_begin);
+        }
+
+        JsonWriter& JsonWriter::child(Visualizable& visualizable, const char* field, int i, int j) {
+            // emit the separator now and keep the value slot open, so
+            // that what follows is exactly the child's JSON.
+            separate();
+            after_key = true;
+            size_t begin = out.size();
+            child_depth++;
+            write_child(visualizable);
+            child_depth--;
+            after_key = false;
+            if (child_spans == nullptr || child_depth > 0)
+                return *this;
+
+            std::string path(field);
+            if (i >= 0) path += "/" + std::to_string(i);
+            if (j >= 0) path += "/" + std::to_string(j);
+            child_spans->push_back(ChildSpan{path, begin, out.size()});
+            return *this;
+        }
+
+        void JsonWriter::splice_child(const JsonWriter& fragment, const char* field, int i, int j) {
+            separate();
+            size_t begin = out.size();
+            out += fragment.out;
+            binary_blocks += fragment.binary_blocks;
+            if (child_spans != nullptr && child_depth == 0) {
+                std::string path(field);
+                if (i >= 0) path += "/" + std::to_string(i);
+                if (j >= 0) path += "/" + std::to_string(j);
+                child_spans->push_back(ChildSpan{path, begin, out.size()});
+            }
+        }
+
+        JsonWriter& JsonWriter::children(Visualizable* const* items, size_t count, const char* field, int i) {
+            size_t threshold = parallel_threshold.load();
+            size_t start = out.size() + binary_blocks.size();
+            size_t k = 0;
+            while (k < count) {
+                child(*items[k], field, i >= 0 ? i : (int)k, i >= 0 ? (int)k : -1);
+                k++;
+                // extrapolate from what was written so far.
+                size_t written = out.size() + binary_blocks.size() - start;
+                if (threshold > 0 && count - k >= 2 && written / k * (count - k) >= threshold)
+                    break;
+            }
+            if (k < count)
+                serialize_in_parallel(items, count, field, i, k);
+            return *this;
+        }
+
+        // State shared between a serialize_in_parallel call and the pool
+        // tasks helping it; helpers may start after the call returned.
+        struct ParallelJob {
+            std::atomic<size_t> next;
+            std::atomic<size_t> done;
+            size_t count;
+            Visualizable* const* items;
+            JsonWriter* fragments;
+            std::mutex mutex;
+            std::condition_variable finished;
+            std::exception_ptr error;
+
+            // serializes items until none are left unclaimed.
+            void work() {
+                size_t k;
+                while ((k = next++) < count) {
+                    try {
+                        fragments[k].child(*items[k], "");
+                    } catch (...) {
+                        std::lock_guard<std::mutex> guard(mutex);
+                        error = std::current_exception();
+                    }
+                    if (++done == count) {
+                        std::lock_guard<std::mutex> guard(mutex);
+                        finished.notify_all();
+                    }
+                }
+            }
+        };
+
+        void JsonWriter::serialize_in_parallel(Visualizable* const* items, size_t count,
+                                               const char* field, int i, size_t first_index) {
+            auto workers = serialization_pool();
+            size_t remaining = count - first_index;
+            std::vector<JsonWriter> fragments(remaining);
+            for (auto& fragment: fragments) {
+                fragment.binary_arrays = binary_arrays;
+                fragment.fragment_cache = fragment_cache;
+                fragment.format = format;
+            }
+            auto job = std::make_shared<ParallelJob>();
+            job->next = 0;
+            job->done = 0;
+            job->count = remaining;
+            job->items = items + first_index;
+            job->fragments = fragments.data();
+            if (workers != nullptr) {
+                size_t helpers = std::min<size_t>(workers->num_workers(), remaining - 1);
+                for (size_t h = 0; h < helpers; ++h) {
+                    workers->push([job]() { job->work(); });
+                }
+            }
+            // takes items too, so this finishes even if the pool is busy.
+            job->work();
+            {
+                std::unique_lock<std::mutex> lock(job->mutex);
+                job->finished.wait(lock, [&job]() { return job->done.load() == job->count; });
+                if (job->error)
+                    std::rethrow_exception(job->error);
+            }
+            for (size_t k = 0; k < remaining; ++k) {
+                size_t index = first_index + k;
+                splice_child(fragments[k], field, i >= 0 ? i : (int)index, i >= 0 ? (int)index : -1);
+            }
+        }
+
+        JsonWriter& JsonWriter::raw(const std::string& json) {
+            separate();
+            out += json;
+            return *this;
+        }
+
+        JsonWriter& JsonWriter::raw(const char* json, size_t length) {
+            separate();
+            out.append(json, length);
+            return *this;
+        }
+    }
+}
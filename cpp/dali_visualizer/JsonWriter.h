@@ -0,0 +1,210 @@
+#ifndef DALI_VISUALIZER_JSON_WRITER_H
+#define DALI_VISUALIZER_JSON_WRITER_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <json11.hpp>
+
+namespace dali {
+    namespace visualizer {
+        struct Visualizable;
+
+        // Where a direct child of the serialized object ended up in the
+        // output, see JsonWriter::record_children.
+        struct ChildSpan {
+            std::string path;
+            size_t begin;
+            size_t end;
+        };
+
+        class JsonWriter;
+
+        // How JsonWriter writes numbers as text (binary arrays are
+        // float32 either way). The default matches %.17g.
+        struct NumberFormat {
+            // Significant digits, 1 to 17. 0 writes float32 numbers
+            // (with keep_float32) with the fewest digits that read back
+            // as the same float, and other numbers with 17. Whole
+            // numbers below 10^15 are written in full either way.
+            int precision = 17;
+            // Formats float data (weights, scores, probabilities of
+            // float models) as float32 rather than widening it to double
+            // first: at most 9 digits, and 0.3f comes out as 0.3 instead
+            // of 0.30000001192092896 with precision 0.
+            bool keep_float32 = false;
+
+            NumberFormat() = default;
+            NumberFormat(int precision, bool keep_float32=false);
+        };
+
+        // Serialized form of a visualizable from the last time it was
+        // written through JsonWriter::child, while fragment caching was
+        // on. Valid as long as the visualizable's content_version and the
+        // writer settings are the same. Copies start out empty.
+        class FragmentCache {
+            private:
+                std::mutex cache_mutex;
+                uint64_t version = 0;
+                int settings = -1;
+                std::string text;
+                std::string blocks;
+            public:
+                FragmentCache() = default;
+                FragmentCache(const FragmentCache&);
+                FragmentCache& operator=(const FragmentCache&);
+
+                // Appends the cached fragment to writer's output (the
+                // separator is up to the caller). Returns false on a miss.
+                bool splice_into(uint64_t version, int settings, std::string& text_out, std::string& blocks_out);
+                void store(uint64_t version, int settings,
+                           const char* text, size_t text_length,
+                           const char* blocks, size_t blocks_length);
+        };
+
+        // Appends JSON text straight into a reusable buffer, so that
+        // visualizables can be serialized in one pass without building a
+        // json11::Json tree first. clear() keeps the allocated capacity.
+        //
+        //     writer.begin_object()
+        //           .key("type").value("sentence")
+        //           .key("weights").number_array(weights.data(), weights.size())
+        //           .end_object();
+        class JsonWriter {
+            private:
+                std::string out;
+                // one entry per open object/array: has it got elements yet?
+                std::vector<bool> has_elements;
+                bool after_key = false;
+
+                // see set_binary_arrays.
+                bool binary_arrays = false;
+                std::string binary_blocks;
+
+                // see record_children.
+                std::vector<ChildSpan>* child_spans = nullptr;
+                int child_depth = 0;
+
+                // see set_fragment_cache.
+                bool fragment_cache = false;
+
+                // see set_number_format.
+                NumberFormat format;
+
+                void separate();
+                // writes visualizable (as a value whose separator was
+                // already written), through its cache if enabled.
+                void write_child(Visualizable& visualizable);
+                // what cached fragments depend on besides the content.
+                int settings_key() const;
+                void write_string(const char* str, size_t length);
+                // float32 says number was a float, see
+                // NumberFormat::keep_float32.
+                void write_number(double number, bool float32=false);
+                // writes digits * 10^exponent in %g style, switching to
+                // scientific notation from 10^fixed_limit on.
+                void write_decimal(bool negative, uint64_t digits, int exponent, int fixed_limit);
+                // writes fragment (serialized by another writer) as the
+                // child at field/i/j.
+                void splice_child(const JsonWriter& fragment, const char* field, int i, int j);
+                void serialize_in_parallel(Visualizable* const* items, size_t count,
+                                           const char* field, int i, size_t first_index);
+            public:
+                JsonWriter();
+
+                void clear();
+                const std::string& str() const;
+                size_t size() const;
+
+                // When on, number_array writes a {"__f32__": n} placeholder
+                // and appends the n numbers as little-endian float32 to
+                // blocks() instead (see WireFormat.h).
+                void set_binary_arrays(bool enabled);
+                const std::string& blocks() const;
+
+                // When on, child() reuses the bytes a visualizable was last
+                // serialized to as long as its content_version is
+                // unchanged, see Visualizable::mark_changed.
+                void set_fragment_cache(bool enabled);
+
+                // Applies to every number written as text from here on.
+                void set_number_format(NumberFormat format);
+                const NumberFormat& number_format() const;
+
+                // While set, every child written through child() directly
+                // by the top-level object gets its path and position in
+                // str() appended to spans. Pass nullptr to stop.
+                void record_children(std::vector<ChildSpan>* spans);
+
+                JsonWriter& begin_object();
+                JsonWriter& end_object();
+                JsonWriter& begin_array();
+                JsonWriter& end_array();
+
+                JsonWriter& key(const char* name);
+                JsonWriter& key(const std::string& name);
+
+                JsonWriter& value(const char* str);
+                JsonWriter& value(const std::string& str);
+                JsonWriter& value(double number);
+                JsonWriter& value(float number);
+                JsonWriter& value(int number);
+                JsonWriter& value(bool boolean);
+                JsonWriter& value(const json11::Json& json);
+                JsonWriter& null();
+
+                template<typename R>
+                JsonWriter& number_array(const R* data, size_t length);
+                template<typename R>
+                JsonWriter& number_array(const std::vector<R>& numbers);
+                JsonWriter& string_array(const std::vector<std::string>& strings);
+                // Always written as text, even with binary arrays on.
+                JsonWriter& int_array(const std::vector<int>& numbers);
+
+                // Writes a nested visualizable. Composites go through this
+                // so that the child's location can be recorded. Its path
+                // is field[/i[/j]], e.g. child(card, "grid", 0, 2) is at
+                // json["grid"][0][2].
+                JsonWriter& child(Visualizable& visualizable, const char* field, int i=-1, int j=-1);
+
+                // Writes items as consecutive values, at paths field/k (or
+                // field/i/k if i is given). Once the first few suggest the
+                // whole lot is larger than the parallel serialization
+                // threshold, the rest are serialized on the shared pool
+                // and spliced in order; the output is the same either way.
+                template<typename T>
+                JsonWriter& children(const std::vector<std::shared_ptr<T>>& items, const char* field, int i=-1);
+                JsonWriter& children(Visualizable* const* items, size_t count, const char* field, int i=-1);
+
+                // Splices an already serialized JSON value.
+                JsonWriter& raw(const std::string& json);
+                JsonWriter& raw(const char* json, size_t length);
+        };
+
+        template<typename R>
+        JsonWriter& JsonWriter::number_array(const std::vector<R>& numbers) {
+            return number_array(numbers.data(), numbers.size());
+        }
+
+        template<typename T>
+        JsonWriter& JsonWriter::children(const std::vector<std::shared_ptr<T>>& items, const char* field, int i) {
+            std::vector<Visualizable*> pointers;
+            pointers.reserve(items.size());
+            for (auto& item: items) {
+                pointers.push_back(item.get());
+            }
+            return children(pointers.data(), pointers.size(), field, i);
+        }
+
+        // Composites whose children add up to at least threshold_bytes of
+        // output serialize them on a pool of num_threads shared by the
+        // whole process (0 turns it off). The default is 64KB on one
+        // thread per core; num_threads only counts before the first
+        // parallel serialization.
+        void set_parallel_serialization(size_t threshold_bytes, int num_threads=-1);
+    }
+}
+
+#endif
@@ -0,0 +1,98 @@
+#include "KeyedFeed.h"
+
+#include "dali_visualizer/visualizer.h"
+
+namespace dali {
+    namespace visualizer {
+        // FNV-1a, enough to tell whether a fragment changed.
+        static uint64_t hash_bytes(const char* data, size_t length, uint64_t hash = 14695981039346656037ULL) {
+            for (size_t i = 0; i < length; ++i) {
+                hash ^= static_cast<uint8_t>(data[i]);
+                hash *= 1099511628211ULL;
+            }
+            return hash;
+        }
+
+        KeyedFeed::KeyedFeed(std::string key_) : key(key_) {
+        }
+
+        void KeyedFeed::invalidate() {
+            std::lock_guard<std::mutex> guard(state_mutex);
+            needs_snapshot = true;
+        }
+
+        bool KeyedFeed::update(Visualizable& obj, clock_t::duration snapshot_interval, std::string& message,
+                               bool fragment_cache, NumberFormat number_format) {
+            std::lock_guard<std::mutex> guard(state_mutex);
+
+            spans.clear();
+            writer.clear();
+            writer.set_fragment_cache(fragment_cache);
+            writer.set_number_format(number_format);
+            writer.record_children(&spans);
+            obj.write_json(writer);
+            writer.record_children(nullptr);
+            const std::string& json = writer.str();
+
+            // the shell is the object with every child cut out; paths stand
+            // in for them so that moving children around changes it too.
+            uint64_t new_shell_hash = hash_bytes(nullptr, 0);
+            size_t position = 0;
+            for (auto& span: spans) {
+                new_shell_hash = hash_bytes(json.data() + position, span.begin - position, new_shell_hash);
+                new_shell_hash = hash_bytes(span.path.data(), span.path.size(), new_shell_hash);
+                position = span.end;
+            }
+            new_shell_hash = hash_bytes(json.data() + position, json.size() - position, new_shell_hash);
+
+            auto now = clock_t::now();
+            bool snapshot = needs_snapshot ||
+                            now - last_snapshot >= snapshot_interval ||
+                            new_shell_hash != shell_hash ||
+                            spans.size() != child_hashes.size();
+
+            message_writer.clear();
+            message_writer.begin_object();
+            bool changed = false;
+            if (!snapshot) {
+                for (size_t i = 0; i < spans.size(); ++i) {
+                    auto& span = spans[i];
+                    uint64_t child_hash = hash_bytes(json.data() + span.begin, span.end - span.begin);
+                    if (child_hash == child_hashes[i].second)
+                        continue;
+                    if (!changed) {
+                        message_writer.key("type").value("keyed_patch")
+                                      .key("key").value(key)
+                                      .key("version").value((double)(version + 1))
+                                      .key("base_version").value((double)version)
+                                      .key("changes").begin_object();
+                        changed = true;
+                    }
+                    child_hashes[i].second = child_hash;
+                    message_writer.key(span.path).raw(json.data() + span.begin, span.end - span.begin);
+                }
+                if (!changed)
+                    return false;
+                message_writer.end_object();
+            } else {
+                child_hashes.resize(spans.size());
+                for (size_t i = 0; i < spans.size(); ++i) {
+                    auto& span = spans[i];
+                    child_hashes[i].first = span.path;
+                    child_hashes[i].second = hash_bytes(json.data() + span.begin, span.end - span.begin);
+                }
+                shell_hash = new_shell_hash;
+                needs_snapshot = false;
+                last_snapshot = now;
+                message_writer.key("type").value("keyed_snapshot")
+                              .key("key").value(key)
+                              .key("version").value((double)(version + 1))
+                              .key("value").raw(json);
+            }
+            message_writer.end_object();
+            version++;
+            message.assign(message_writer.str());
+            return true;
+        }
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef DALI_VISUALIZER_KEYED_FEED_H
+#define DALI_VISUALIZER_KEYED_FEED_H
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "dali_visualizer/JsonWriter.h"
+
+namespace dali {
+    namespace visualizer {
+        struct Visualizable;
+
+        // Remembers what was last sent for one long-lived visualizable, so
+        // that re-feeding it only publishes the direct children that
+        // changed:
+        //
+        //     {"type": "keyed_snapshot", "key": k, "version": v, "value": {..}}
+        //     {"type": "keyed_patch", "key": k, "version": v, "base_version": v - 1,
+        //      "changes": {"grid/0/2": {..}, ..}}
+        //
+        // A patch replaces json[path] of the last known value (paths as
+        // in JsonWriter::child). A full snapshot is sent instead on the
+        // first update, whenever the shape or the object's own fields
+        // change, and at least every snapshot_interval for late
+        // subscribers.
+        class KeyedFeed {
+            public:
+                typedef std::chrono::steady_clock clock_t;
+            private:
+                const std::string key;
+
+                std::mutex state_mutex;
+                uint64_t version = 0;
+                bool needs_snapshot = true;
+                clock_t::time_point last_snapshot;
+                // hash of everything outside of the children.
+                uint64_t shell_hash = 0;
+                std::vector<std::pair<std::string, uint64_t>> child_hashes;
+
+                // reused between updates.
+                JsonWriter writer;
+                JsonWriter message_writer;
+                std::vector<ChildSpan> spans;
+            public:
+                KeyedFeed(std::string key);
+
+                // Serializes obj (see JsonWriter::set_fragment_cache and
+                // set_number_format for the last two) and fills message
+                // with what has to be published. Returns false if nothing
+                // changed.
+                bool update(Visualizable& obj, clock_t::duration snapshot_interval, std::string& message,
+                            bool fragment_cache=false, NumberFormat number_format=NumberFormat());
+
+                // The next update sends a full snapshot.
+                void invalidate();
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,52 @@
+#include "SampledFeed.h"
+
+#include "dali_visualizer/visualizer.h"
+
+namespace dali {
+    namespace visualizer {
+        SampledFeed::SampledFeed(std::string key_) :
+                key(key_),
+                window(clock_t::duration::zero()),
+                random(std::random_device()()) {
+        }
+
+        int SampledFeed::admit() {
+            if (seen == 0)
+                window_start = clock_t::now();
+            seen++;
+            if (samples.size() < sample_size) {
+                samples.emplace_back();
+                return samples.size() - 1;
+            }
+            // replace a random sample with probability sample_size / seen.
+            uint64_t draw = std::uniform_int_distribution<uint64_t>(0, seen - 1)(random);
+            return draw < sample_size ? (int)draw : -1;
+        }
+
+        bool SampledFeed::flush(bool force, std::string& message, NumberFormat number_format) {
+            std::lock_guard<std::mutex> guard(state_mutex);
+            if (seen == 0)
+                return false;
+            if (!force && clock_t::now() - window_start < window)
+                return false;
+
+            writer.clear();
+            writer.set_number_format(number_format);
+            writer.begin_object()
+                  .key("type").value("sampled")
+                  .key("key").value(key)
+                  .key("seen").value((double)seen)
+                  .key("samples").begin_array();
+            for (size_t i = 0; i < samples.size(); ++i) {
+                if (samples[i] != nullptr)
+                    writer.child(*samples[i], "samples", i);
+            }
+            writer.end_array().end_object();
+            message.assign(writer.str());
+
+            samples.clear();
+            seen = 0;
+            return true;
+        }
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef DALI_VISUALIZER_SAMPLED_FEED_H
+#define DALI_VISUALIZER_SAMPLED_FEED_H
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "dali_visualizer/JsonWriter.h"
+
+namespace dali {
+    namespace visualizer {
+        struct Visualizable;
+
+        // Uniform sample (reservoir sampling, algorithm R) of the
+        // candidates offered under one key during a window. Candidates
+        // stay unserialized until the window is flushed as
+        //
+        //     {"type": "sampled", "key": k, "seen": n, "samples": [..]}
+        //
+        // where n counts every candidate offered in the window.
+        class SampledFeed {
+            public:
+                typedef std::chrono::steady_clock clock_t;
+            private:
+                const std::string key;
+
+                std::mutex state_mutex;
+                size_t sample_size = 1;
+                clock_t::duration window;
+                // only meaningful while seen > 0.
+                clock_t::time_point window_start;
+                uint64_t seen = 0;
+                std::vector<std::shared_ptr<Visualizable>> samples;
+                std::minstd_rand random;
+
+                JsonWriter writer;
+
+                // Counts a candidate and returns the index in samples it
+                // should go to, or -1 if it is not sampled.
+                int admit();
+            public:
+                SampledFeed(std::string key);
+
+                // make() builds the candidate; it is only called (under
+                // this feed's lock) when the candidate enters the sample.
+                // It is serialized at flush, so it has to own its data.
+                // Flush a window that is over first, or the candidate
+                // counts towards it.
+                template<typename F>
+                void offer(F&& make, clock_t::duration window_, size_t sample_size_) {
+                    std::lock_guard<std::mutex> guard(state_mutex);
+                    window = window_;
+                    sample_size = sample_size_ > 0 ? sample_size_ : 1;
+                    int index = admit();
+                    if (index >= 0)
+                        samples[index] = make();
+                }
+
+                // Fills message with the samples (numbers written in
+                // number_format) and starts a new window if the current
+                // one is over (or force and it has any). Returns false if
+                // there is nothing to publish.
+                bool flush(bool force, std::string& message,
+                           NumberFormat number_format=NumberFormat());
+        };
+    }
+}
+
+#endif
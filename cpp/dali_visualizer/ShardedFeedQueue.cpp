@@ -0,0 +1,262 @@
+#include "ShardedFeedQueue.h"
+
+#include <algorithm>
+#include <deque>
+#include <unordered_map>
+
+namespace dali {
+    namespace visualizer {
+        struct FeedShard {
+            // shared between the owning thread and the consumer only.
+            std::mutex staging_mutex;
+            std::condition_variable not_full;
+            std::deque<FeedMessage> staging;
+            // only touched by the consumer; always older than staging.
+            std::deque<FeedMessage> draining;
+            // messages in staging and draining.
+            std::atomic<size_t> pending;
+            std::atomic<uint64_t> dropped;
+            // set once the owning thread exited.
+            std::atomic<bool> orphaned;
+
+            FeedShard() : pending(0), dropped(0), orphaned(false) {
+            }
+        };
+
+        // The shards of the current thread, by queue. Holding them here
+        // keeps a shard alive for as long as its thread may push to it.
+        struct ThreadShards {
+            std::unordered_map<uint64_t, std::shared_ptr<FeedShard>> shards;
+
+            ~ThreadShards() {
+                for (auto& kv: shards) {
+                    kv.second->orphaned.store(true);
+                }
+            }
+        };
+
+        static thread_local ThreadShards thread_shards;
+        static std::atomic<uint64_t> next_queue_id(0);
+
+        ShardedFeedQueue::ShardedFeedQueue(size_t capacity_, OverflowPolicy policy_) :
+                capacity(capacity_ > 0 ? capacity_ : 1),
+                policy(policy_),
+                queue_id(next_queue_id++),
+                closed(false),
+                sealed(false),
+                shards_added(false),
+                dropped_outside_shards(0),
+                consumer_waiting(false) {
+        }
+
+        FeedShard& ShardedFeedQueue::thread_shard() {
+            auto& shard = thread_shards.shards[queue_id];
+            if (shard == nullptr) {
+                shard = std::make_shared<FeedShard>();
+                std::lock_guard<std::mutex> guard(shards_mutex);
+                shards.push_back(shard);
+                shards_added.store(true);
+            }
+            return *shard;
+        }
+
+        bool ShardedFeedQueue::push(message_t message) {
+            if (closed.load()) {
+                dropped_outside_shards++;
+                return false;
+            }
+            auto& shard = thread_shard();
+            bool lost_message = false;
+            {
+                std::unique_lock<std::mutex> lock(shard.staging_mutex);
+                if (closed.load()) {
+                    shard.dropped++;
+                    return false;
+                }
+                if (shard.pending.load() >= capacity) {
+                    switch (policy) {
+                        case OverflowPolicy::DROP_NEWEST:
+                            shard.dropped++;
+                            return false;
+                        case OverflowPolicy::DROP_OLDEST:
+                            // the older ones belong to the consumer now.
+                            if (shard.staging.empty()) {
+                                shard.dropped++;
+                                return false;
+                            }
+                            shard.staging.pop_front();
+                            shard.pending--;
+                            shard.dropped++;
+                            lost_message = true;
+                            break;
+                        case OverflowPolicy::BLOCK:
+                            shard.not_full.wait(lock, [this, &shard]() {
+                                return closed.load() || shard.pending.load() < capacity;
+                            });
+                            if (closed.load()) {
+                                shard.dropped++;
+                                return false;
+                            }
+                            break;
+                    }
+                }
+                message.enqueued = clock_t::now();
+                shard.staging.push_back(std::move(message));
+                // pairs with wait_for_messages: either the consumer sees
+                // the count or we see that it is waiting.
+                shard.pending++;
+            }
+            if (consumer_waiting.load() && consumer_waiting.exchange(false)) {
+                std::lock_guard<std::mutex> guard(wakeup_mutex);
+                wakeup.notify_one();
+            }
+            return !lost_message;
+        }
+
+        bool ShardedFeedQueue::try_pop(message_t& message) {
+            if (shards_added.exchange(false)) {
+                std::lock_guard<std::mutex> guard(shards_mutex);
+                consumer_shards = shards;
+            }
+            FeedShard* oldest = nullptr;
+            for (auto& shard: consumer_shards) {
+                if (shard->draining.empty() && shard->pending.load() > 0) {
+                    std::lock_guard<std::mutex> guard(shard->staging_mutex);
+                    shard->draining.swap(shard->staging);
+                }
+                if (!shard->draining.empty() && (oldest == nullptr ||
+                        shard->draining.front().enqueued < oldest->draining.front().enqueued)) {
+                    oldest = shard.get();
+                }
+            }
+            if (oldest == nullptr)
+                return false;
+            message = std::move(oldest->draining.front());
+            oldest->draining.pop_front();
+            if (oldest->pending-- >= capacity && policy == OverflowPolicy::BLOCK) {
+                // the producer checks pending under this lock before it
+                // waits, so taking it here means it cannot miss this.
+                {
+                    std::lock_guard<std::mutex> guard(oldest->staging_mutex);
+                }
+                oldest->not_full.notify_all();
+            }
+            return true;
+        }
+
+        void ShardedFeedQueue::remove_orphaned_shards() {
+            bool any = false;
+            for (auto& shard: consumer_shards) {
+                if (shard->orphaned.load() && shard->pending.load() == 0)
+                    any = true;
+            }
+            if (!any)
+                return;
+            std::lock_guard<std::mutex> guard(shards_mutex);
+            std::vector<std::shared_ptr<FeedShard>> live;
+            for (auto& shard: shards) {
+                if (!shard->orphaned.load() || shard->pending.load() > 0) {
+                    live.push_back(shard);
+                } else {
+                    dropped_outside_shards += shard->dropped.load();
+                }
+            }
+            shards.swap(live);
+            consumer_shards = shards;
+        }
+
+        // Returns false if deadline passed.
+        bool ShardedFeedQueue::wait_for_messages(bool has_deadline, clock_t::time_point deadline) {
+            std::unique_lock<std::mutex> lock(wakeup_mutex);
+            consumer_waiting.store(true);
+            auto ready = [this]() {
+                if (sealed.load() || shards_added.load())
+                    return true;
+                for (auto& shard: consumer_shards) {
+                    if (shard->pending.load() > 0)
+                        return true;
+                }
+                return false;
+            };
+            bool woken = true;
+            if (has_deadline) {
+                woken = wakeup.wait_until(lock, deadline, [this, &ready]() {
+                    return !consumer_waiting.load() || ready();
+                });
+            } else {
+                wakeup.wait(lock, [this, &ready]() {
+                    return !consumer_waiting.load() || ready();
+                });
+            }
+            consumer_waiting.store(false);
+            return woken;
+        }
+
+        bool ShardedFeedQueue::pop(message_t& message) {
+            while (true) {
+                bool was_sealed = sealed.load();
+                if (try_pop(message))
+                    return true;
+                if (was_sealed)
+                    return false;
+                remove_orphaned_shards();
+                wait_for_messages(false, clock_t::time_point());
+            }
+        }
+
+        bool ShardedFeedQueue::pop_until(message_t& message, clock_t::time_point deadline) {
+            while (true) {
+                bool was_sealed = sealed.load();
+                if (try_pop(message))
+                    return true;
+                if (was_sealed)
+                    return false;
+                if (!wait_for_messages(true, deadline))
+                    return try_pop(message);
+            }
+        }
+
+        void ShardedFeedQueue::close() {
+            closed.store(true);
+            std::vector<std::shared_ptr<FeedShard>> current;
+            {
+                std::lock_guard<std::mutex> guard(shards_mutex);
+                current = shards;
+            }
+            // a push that saw closed unset finishes before we let go of
+            // its shard.
+            for (auto& shard: current) {
+                {
+                    std::lock_guard<std::mutex> guard(shard->staging_mutex);
+                }
+                shard->not_full.notify_all();
+            }
+            sealed.store(true);
+            std::lock_guard<std::mutex> guard(wakeup_mutex);
+            wakeup.notify_all();
+        }
+
+        size_t ShardedFeedQueue::size() {
+            std::lock_guard<std::mutex> guard(shards_mutex);
+            size_t total = 0;
+            for (auto& shard: shards) {
+                total += shard->pending.load();
+            }
+            return total;
+        }
+
+        uint64_t ShardedFeedQueue::num_dropped() const {
+            std::lock_guard<std::mutex> guard(shards_mutex);
+            uint64_t total = dropped_outside_shards.load();
+            for (auto& shard: shards) {
+                total += shard->dropped.load();
+            }
+            return total;
+        }
+
+        size_t ShardedFeedQueue::max_size() {
+            std::lock_guard<std::mutex> guard(shards_mutex);
+            return capacity * std::max<size_t>(1, shards.size());
+        }
+    }
+}
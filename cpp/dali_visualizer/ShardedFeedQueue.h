@@ -0,0 +1,72 @@
+#ifndef DALI_VISUALIZER_SHARDED_FEED_QUEUE_H
+#define DALI_VISUALIZER_SHARDED_FEED_QUEUE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "dali_visualizer/FeedQueue.h"
+
+namespace dali {
+    namespace visualizer {
+        struct FeedShard;
+
+        // Feed queue for many producer threads: each thread appends to its
+        // own staging buffer (created on its first push), whose lock is
+        // only ever shared with the publisher, which swaps the whole
+        // buffer out at once. The publisher merges the buffers by enqueue
+        // time, so messages of one thread keep their order.
+        //
+        // capacity and policy apply to each thread's messages that the
+        // publisher has not popped yet, including those it already
+        // swapped out. Once all of them are swapped out, DROP_OLDEST
+        // drops the new message instead.
+        class ShardedFeedQueue : public FeedQueue {
+            private:
+                const size_t capacity;
+                const OverflowPolicy policy;
+                // keys this queue's shards in the per-thread tables.
+                const uint64_t queue_id;
+
+                // rejects pushes; sealed is set once the pushes that
+                // raced with close are in.
+                std::atomic<bool> closed;
+                std::atomic<bool> sealed;
+
+                mutable std::mutex shards_mutex;
+                std::vector<std::shared_ptr<FeedShard>> shards;
+                std::atomic<bool> shards_added;
+                // pushes after close, and drops of shards since removed.
+                std::atomic<uint64_t> dropped_outside_shards;
+
+                // only touched by the consumer.
+                std::vector<std::shared_ptr<FeedShard>> consumer_shards;
+
+                std::mutex wakeup_mutex;
+                std::condition_variable wakeup;
+                std::atomic<bool> consumer_waiting;
+
+                FeedShard& thread_shard();
+                // moves the oldest available message into message.
+                bool try_pop(message_t& message);
+                void remove_orphaned_shards();
+                bool wait_for_messages(bool has_deadline, clock_t::time_point deadline);
+            public:
+                ShardedFeedQueue(size_t capacity, OverflowPolicy policy);
+
+                virtual bool push(message_t message) override;
+                virtual bool pop(message_t& message) override;
+                virtual bool pop_until(message_t& message, clock_t::time_point deadline) override;
+                virtual void close() override;
+                virtual size_t size() override;
+                virtual uint64_t num_dropped() const override;
+                // capacity times the number of producer threads.
+                virtual size_t max_size() override;
+        };
+    }
+}
+
+#endif
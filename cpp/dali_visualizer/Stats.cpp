@@ -0,0 +1,123 @@
+#include "Stats.h"
+
+#include <algorithm>
+
+namespace dali {
+    namespace visualizer {
+        const int LatencyHistogram::NUM_BUCKETS;
+
+        LatencyHistogram::LatencyHistogram() : count(0), total_ns(0), max_ns(0) {
+            for (auto& bucket: buckets) {
+                bucket.store(0);
+            }
+        }
+
+        void LatencyHistogram::record(std::chrono::nanoseconds duration) {
+            uint64_t ns = duration.count() > 0 ? duration.count() : 0;
+            int bucket = ns == 0 ? 0 : 63 - __builtin_clzll(ns);
+            if (bucket >= NUM_BUCKETS)
+                bucket = NUM_BUCKETS - 1;
+            buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+            count.fetch_add(1, std::memory_order_relaxed);
+            total_ns.fetch_add(ns, std::memory_order_relaxed);
+            uint64_t seen_max = max_ns.load(std::memory_order_relaxed);
+            while (ns > seen_max &&
+                   !max_ns.compare_exchange_weak(seen_max, ns, std::memory_order_relaxed)) {
+            }
+        }
+
+        uint64_t LatencyHistogram::num_samples() const {
+            return count.load();
+        }
+
+        std::chrono::nanoseconds LatencyHistogram::quantile(double q) const {
+            uint64_t total = count.load();
+            if (total == 0)
+                return std::chrono::nanoseconds::zero();
+            uint64_t rank = (uint64_t)(q * total);
+            uint64_t seen = 0;
+            for (int bucket = 0; bucket < NUM_BUCKETS; ++bucket) {
+                seen += buckets[bucket].load(std::memory_order_relaxed);
+                if (seen > rank)
+                    return std::chrono::nanoseconds(std::min<uint64_t>(1ULL << (bucket + 1), max_ns.load()));
+            }
+            return std::chrono::nanoseconds(max_ns.load());
+        }
+
+        json11::Json LatencyHistogram::to_json() const {
+            uint64_t total = count.load();
+            auto us = [](std::chrono::nanoseconds ns) { return ns.count() / 1000.0; };
+            return json11::Json::object {
+                { "count", (double)total },
+                { "mean_us", total > 0 ? total_ns.load() / 1000.0 / total : 0.0 },
+                { "p50_us", us(quantile(0.5)) },
+                { "p90_us", us(quantile(0.9)) },
+                { "p99_us", us(quantile(0.99)) },
+                { "max_us", max_ns.load() / 1000.0 },
+            };
+        }
+
+        VisualizerStats::ChannelStats::ChannelStats() : messages(0), bytes(0) {
+        }
+
+        VisualizerStats::VisualizerStats() :
+                connected_before(false),
+                dropped_disconnected(0),
+                reconnects(0),
+                connection_attempts(0) {
+        }
+
+        void VisualizerStats::record_connected() {
+            if (connected_before.exchange(true))
+                reconnects++;
+        }
+
+        void VisualizerStats::record_publish(const std::string& channel, size_t bytes) {
+            ChannelStats* stats;
+            {
+                std::lock_guard<std::mutex> guard(channels_mutex);
+                auto& entry = channels[channel];
+                if (entry == nullptr)
+                    entry.reset(new ChannelStats());
+                stats = entry.get();
+            }
+            stats->messages.fetch_add(1, std::memory_order_relaxed);
+            stats->bytes.fetch_add(bytes, std::memory_order_relaxed);
+        }
+
+        uint64_t VisualizerStats::messages_published(const std::string& channel) {
+            std::lock_guard<std::mutex> guard(channels_mutex);
+            auto it = channels.find(channel);
+            return it == channels.end() ? 0 : it->second->messages.load();
+        }
+
+        uint64_t VisualizerStats::bytes_published(const std::string& channel) {
+            std::lock_guard<std::mutex> guard(channels_mutex);
+            auto it = channels.find(channel);
+            return it == channels.end() ? 0 : it->second->bytes.load();
+        }
+
+        json11::Json VisualizerStats::to_json() {
+            json11::Json::object per_channel;
+            {
+                std::lock_guard<std::mutex> guard(channels_mutex);
+                for (auto& kv: channels) {
+                    per_channel[kv.first] = json11::Json::object {
+                        { "messages", (double)kv.second->messages.load() },
+                        { "bytes", (double)kv.second->bytes.load() },
+                    };
+                }
+            }
+            return json11::Json::object {
+                { "channels", per_channel },
+                { "serialize_time", serialize_time.to_json() },
+                { "publish_latency", publish_latency.to_json() },
+                { "callcenter_queue_time", callcenter_queue_time.to_json() },
+                { "callcenter_dispatch_time", callcenter_dispatch_time.to_json() },
+                { "dropped_disconnected", (double)dropped_disconnected.load() },
+                { "reconnects", (double)reconnects.load() },
+                { "connection_attempts", (double)connection_attempts.load() },
+            };
+        }
+    }
+}
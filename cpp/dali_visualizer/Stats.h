@@ -0,0 +1,91 @@
+#ifndef DALI_VISUALIZER_STATS_H
+#define DALI_VISUALIZER_STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <json11.hpp>
+
+namespace dali {
+    namespace visualizer {
+        // Histogram of durations in power-of-two nanosecond buckets.
+        // Recording is lock-free; percentiles are accurate to a factor
+        // of two.
+        class LatencyHistogram {
+            public:
+                // bucket b counts durations in [2^b, 2^(b+1)) ns, the last
+                // one everything above.
+                static const int NUM_BUCKETS = 40;
+            private:
+                std::atomic<uint64_t> buckets[NUM_BUCKETS];
+                std::atomic<uint64_t> count;
+                std::atomic<uint64_t> total_ns;
+                std::atomic<uint64_t> max_ns;
+            public:
+                LatencyHistogram();
+
+                void record(std::chrono::nanoseconds duration);
+
+                template<typename Clock>
+                void record_since(typename Clock::time_point start) {
+                    record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start));
+                }
+
+                uint64_t num_samples() const;
+                // upper bound of the bucket holding the q-th quantile.
+                std::chrono::nanoseconds quantile(double q) const;
+
+                // {"count", "mean_us", "p50_us", "p90_us", "p99_us", "max_us"}
+                json11::Json to_json() const;
+        };
+
+        // Counters kept by a Visualizer about its own overhead. Every
+        // member can be read (and written) from any thread.
+        class VisualizerStats {
+            public:
+                struct ChannelStats {
+                    std::atomic<uint64_t> messages;
+                    std::atomic<uint64_t> bytes;
+                    ChannelStats();
+                };
+            private:
+                std::mutex channels_mutex;
+                std::unordered_map<std::string, std::unique_ptr<ChannelStats>> channels;
+                std::atomic<bool> connected_before;
+            public:
+                // to_json / write_json plus dump, per message.
+                LatencyHistogram serialize_time;
+                // from feed until the message is handed to redis.
+                LatencyHistogram publish_latency;
+                // from a callcenter request arriving until a worker
+                // picks it up.
+                LatencyHistogram callcenter_queue_time;
+                // running a registered callcenter function.
+                LatencyHistogram callcenter_dispatch_time;
+
+                // messages thrown away because there was no connection.
+                std::atomic<uint64_t> dropped_disconnected;
+                // connections established after the first one.
+                std::atomic<uint64_t> reconnects;
+                // attempts to (re)connect, successful or not.
+                std::atomic<uint64_t> connection_attempts;
+
+                VisualizerStats();
+
+                void record_publish(const std::string& channel, size_t bytes);
+                void record_connected();
+
+                // messages and bytes published on channel so far.
+                uint64_t messages_published(const std::string& channel);
+                uint64_t bytes_published(const std::string& channel);
+
+                json11::Json to_json();
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,145 @@
+#ifndef DALI_VISUALIZER_TASK_H
+#define DALI_VISUALIZER_TASK_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Move-only void() callable, like std::function but without the copy.
+// Callables of up to INLINE_SIZE bytes (which covers the usual lambda
+// capturing a few pointers, or a std::function) are stored inline, so
+// creating and moving a Task does not allocate.
+class Task {
+    public:
+        static const size_t INLINE_SIZE = 48;
+    private:
+        struct Ops {
+            void (*invoke)(void* storage);
+            // move-constructs into to and destroys from.
+            void (*relocate)(void* from, void* to);
+            void (*destroy)(void* storage);
+        };
+
+        template<typename F>
+        struct InlineOps {
+            static void invoke(void* storage) {
+                (*static_cast<F*>(storage))();
+            }
+            static void relocate(void* from, void* to) {
+                new (to) F(std::move(*static_cast<F*>(from)));
+                static_cast<F*>(from)->~F();
+            }
+            static void destroy(void* storage) {
+                static_cast<F*>(storage)->~F();
+            }
+            static const Ops ops;
+        };
+
+        template<typename F>
+        struct HeapOps {
+            static void invoke(void* storage) {
+                (**static_cast<F**>(storage))();
+            }
+            static void relocate(void* from, void* to) {
+                *static_cast<F**>(to) = *static_cast<F**>(from);
+            }
+            static void destroy(void* storage) {
+                delete *static_cast<F**>(storage);
+            }
+            static const Ops ops;
+        };
+
+        template<typename F>
+        struct fits_inline {
+            static const bool value = sizeof(F) <= INLINE_SIZE &&
+                                      alignof(std::max_align_t) % alignof(F) == 0 &&
+                                      std::is_nothrow_move_constructible<F>::value;
+        };
+
+        typename std::aligned_storage<INLINE_SIZE, alignof(std::max_align_t)>::type storage;
+        const Ops* ops = nullptr;
+
+        template<typename F>
+        void store(F&& f, std::true_type /* inline */) {
+            typedef typename std::decay<F>::type callable_t;
+            new (&storage) callable_t(std::forward<F>(f));
+            ops = &InlineOps<callable_t>::ops;
+        }
+
+        template<typename F>
+        void store(F&& f, std::false_type /* inline */) {
+            typedef typename std::decay<F>::type callable_t;
+            *reinterpret_cast<callable_t**>(&storage) = new callable_t(std::forward<F>(f));
+            ops = &HeapOps<callable_t>::ops;
+        }
+    public:
+        Task() noexcept {}
+
+        Task(std::nullptr_t) noexcept {}
+
+        template<typename F,
+                 typename = typename std::enable_if<
+                     !std::is_same<typename std::decay<F>::type, Task>::value>::type>
+        Task(F&& f) {
+            store(std::forward<F>(f),
+                  std::integral_constant<bool, fits_inline<typename std::decay<F>::type>::value>());
+        }
+
+        Task(Task&& other) noexcept : ops(other.ops) {
+            if (ops != nullptr) {
+                ops->relocate(&other.storage, &storage);
+                other.ops = nullptr;
+            }
+        }
+
+        Task& operator=(Task&& other) noexcept {
+            if (this != &other) {
+                reset();
+                if (other.ops != nullptr) {
+                    other.ops->relocate(&other.storage, &storage);
+                    ops = other.ops;
+                    other.ops = nullptr;
+                }
+            }
+            return *this;
+        }
+
+        Task(const Task&) = delete;
+        Task& operator=(const Task&) = delete;
+
+        ~Task() {
+            reset();
+        }
+
+        void reset() {
+            if (ops != nullptr) {
+                ops->destroy(&storage);
+                ops = nullptr;
+            }
+        }
+
+        void operator()() {
+            ops->invoke(&storage);
+        }
+
+        explicit operator bool() const {
+            return ops != nullptr;
+        }
+};
+
+template<typename F>
+const Task::Ops Task::InlineOps<F>::ops = {
+    &Task::InlineOps<F>::invoke,
+    &Task::InlineOps<F>::relocate,
+    &Task::InlineOps<F>::destroy
+};
+
+template<typename F>
+const Task::Ops Task::HeapOps<F>::ops = {
+    &Task::HeapOps<F>::invoke,
+    &Task::HeapOps<F>::relocate,
+    &Task::HeapOps<F>::destroy
+};
+
+#endif
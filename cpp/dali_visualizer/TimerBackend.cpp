@@ -0,0 +1,93 @@
+#include "TimerBackend.h"
+
+TimerBackend::~TimerBackend() {
+}
+
+const size_t HeapTimerBackend::NOT_PENDING;
+
+bool HeapTimerBackend::earlier(const Entry& a, const Entry& b) {
+    if (a.when != b.when)
+        return a.when < b.when;
+    return a.sequence < b.sequence;
+}
+
+void HeapTimerBackend::place(size_t index, const Entry& entry) {
+    heap[index] = entry;
+    position[entry.slot] = index;
+}
+
+void HeapTimerBackend::sift_up(size_t index) {
+    Entry entry = heap[index];
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+        if (!earlier(entry, heap[parent]))
+            break;
+        place(index, heap[parent]);
+        index = parent;
+    }
+    place(index, entry);
+}
+
+void HeapTimerBackend::sift_down(size_t index) {
+    Entry entry = heap[index];
+    while (true) {
+        size_t child = 2 * index + 1;
+        if (child >= heap.size())
+            break;
+        if (child + 1 < heap.size() && earlier(heap[child + 1], heap[child]))
+            child++;
+        if (!earlier(heap[child], entry))
+            break;
+        place(index, heap[child]);
+        index = child;
+    }
+    place(index, entry);
+}
+
+void HeapTimerBackend::remove_at(size_t index) {
+    position[heap[index].slot] = NOT_PENDING;
+    Entry last = heap.back();
+    heap.pop_back();
+    if (index == heap.size())
+        return;
+    place(index, last);
+    if (index > 0 && earlier(last, heap[(index - 1) / 2])) {
+        sift_up(index);
+    } else {
+        sift_down(index);
+    }
+}
+
+void HeapTimerBackend::reserve(size_t num_slots) {
+    if (num_slots > position.size()) {
+        position.resize(num_slots, NOT_PENDING);
+        heap.reserve(num_slots);
+    }
+}
+
+void HeapTimerBackend::insert(slot_t slot, time_point_t when) {
+    heap.push_back({when, next_sequence++, slot});
+    sift_up(heap.size() - 1);
+}
+
+void HeapTimerBackend::remove(slot_t slot) {
+    remove_at(position[slot]);
+}
+
+bool HeapTimerBackend::pop_due(time_point_t now, slot_t& slot) {
+    if (heap.empty() || heap.front().when > now)
+        return false;
+    slot = heap.front().slot;
+    remove_at(0);
+    return true;
+}
+
+TimerBackend::time_point_t HeapTimerBackend::next_deadline() {
+    if (heap.empty())
+        return time_point_t::max();
+    return heap.front().when;
+}
+
+size_t HeapTimerBackend::size() const {
+    return heap.size();
+}
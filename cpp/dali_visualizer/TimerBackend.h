@@ -0,0 +1,72 @@
+#ifndef DALI_VISUALIZER_TIMER_BACKEND_H
+#define DALI_VISUALIZER_TIMER_BACKEND_H
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// Deadline ordering for EventQueue's pending tasks. The tasks themselves
+// live in EventQueue's slot pool; backends only see slot indices, so
+// nothing here allocates once reserve has been called for the pool size.
+// Not thread safe: EventQueue calls it under its queue_mutex.
+class TimerBackend {
+    public:
+        typedef std::chrono::high_resolution_clock clock_t;
+        typedef clock_t::duration duration_t;
+        typedef clock_t::time_point time_point_t;
+        typedef uint64_t timer_id_t;
+        typedef uint32_t slot_t;
+
+        virtual ~TimerBackend();
+
+        // Slots handed to insert are below num_slots. Only ever grows.
+        virtual void reserve(size_t num_slots) = 0;
+
+        // slot must not be pending already.
+        virtual void insert(slot_t slot, time_point_t when) = 0;
+
+        // slot must be pending.
+        virtual void remove(slot_t slot) = 0;
+
+        // Takes out one slot that is due at now. Returns false if there
+        // is none.
+        virtual bool pop_due(time_point_t now, slot_t& slot) = 0;
+
+        // When pop_due should be tried next; time_point_t::max() if there
+        // is nothing pending.
+        virtual time_point_t next_deadline() = 0;
+
+        virtual size_t size() const = 0;
+};
+
+// Binary heap: O(log n) insert, remove and pop. Slots with the same
+// deadline come out in insertion order.
+class HeapTimerBackend : public TimerBackend {
+    private:
+        struct Entry {
+            time_point_t when;
+            uint64_t sequence;
+            slot_t slot;
+        };
+        static const size_t NOT_PENDING = SIZE_MAX;
+
+        std::vector<Entry> heap;
+        // index of each slot in heap, or NOT_PENDING.
+        std::vector<size_t> position;
+        uint64_t next_sequence = 0;
+
+        static bool earlier(const Entry& a, const Entry& b);
+        void place(size_t index, const Entry& entry);
+        void sift_up(size_t index);
+        void sift_down(size_t index);
+        void remove_at(size_t index);
+    public:
+        virtual void reserve(size_t num_slots) override;
+        virtual void insert(slot_t slot, time_point_t when) override;
+        virtual void remove(slot_t slot) override;
+        virtual bool pop_due(time_point_t now, slot_t& slot) override;
+        virtual time_point_t next_deadline() override;
+        virtual size_t size() const override;
+};
+
+#endif
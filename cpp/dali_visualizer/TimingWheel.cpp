@@ -0,0 +1,199 @@
+#include "TimingWheel.h"
+
+#include <algorithm>
+
+TimingWheel::TimingWheel(duration_t resolution_) :
+        resolution(resolution_ > duration_t::zero() ? resolution_ : duration_t(1)),
+        origin(clock_t::now()) {
+    std::fill(&occupied[0][0], &occupied[0][0] + LEVELS * SLOTS / 64, 0);
+    std::fill(level_size, level_size + LEVELS, 0);
+}
+
+uint64_t TimingWheel::tick_at(time_point_t when, bool round_up) const {
+    if (when <= origin)
+        return 0;
+    auto since_origin = when - origin;
+    uint64_t tick = since_origin / resolution;
+    if (round_up && since_origin % resolution != duration_t::zero())
+        tick++;
+    return tick;
+}
+
+TimerBackend::time_point_t TimingWheel::time_at(uint64_t tick) const {
+    return origin + resolution * tick;
+}
+
+void TimingWheel::append(List& list, int32_t node) {
+    nodes[node].next = NONE;
+    nodes[node].prev = list.tail;
+    if (list.tail != NONE) {
+        nodes[list.tail].next = node;
+    } else {
+        list.head = node;
+    }
+    list.tail = node;
+}
+
+void TimingWheel::unlink(List& list, int32_t node) {
+    Node& n = nodes[node];
+    if (n.prev != NONE) {
+        nodes[n.prev].next = n.next;
+    } else {
+        list.head = n.next;
+    }
+    if (n.next != NONE) {
+        nodes[n.next].prev = n.prev;
+    } else {
+        list.tail = n.prev;
+    }
+    n.prev = n.next = NONE;
+}
+
+void TimingWheel::file(int32_t node) {
+    Node& n = nodes[node];
+    if (n.deadline_tick <= current_tick) {
+        n.level = -1;
+        append(due, node);
+        return;
+    }
+    uint64_t delta = n.deadline_tick - current_tick;
+    uint64_t placement = n.deadline_tick;
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= (1ULL << (LEVEL_BITS * (level + 1)))) {
+        level++;
+    }
+    if (delta >= (1ULL << (LEVEL_BITS * LEVELS))) {
+        // beyond the horizon: park it as far as possible, it gets
+        // re-filed when that slot cascades.
+        placement = current_tick + (1ULL << (LEVEL_BITS * LEVELS)) - 1;
+    }
+    int slot = (placement >> (LEVEL_BITS * level)) & (SLOTS - 1);
+    n.level = level;
+    n.slot = slot;
+    append(slots[level][slot], node);
+    occupied[level][slot / 64] |= 1ULL << (slot % 64);
+    level_size[level]++;
+}
+
+void TimingWheel::unfile(int32_t node) {
+    Node& n = nodes[node];
+    if (n.level == -1) {
+        unlink(due, node);
+        return;
+    }
+    int level = n.level, slot = n.slot;
+    List& list = slots[level][slot];
+    unlink(list, node);
+    level_size[level]--;
+    if (list.head == NONE) {
+        occupied[level][slot / 64] &= ~(1ULL << (slot % 64));
+    }
+}
+
+void TimingWheel::cascade(int level, int slot) {
+    int32_t node = slots[level][slot].head;
+    slots[level][slot] = List();
+    occupied[level][slot / 64] &= ~(1ULL << (slot % 64));
+    while (node != NONE) {
+        int32_t next = nodes[node].next;
+        level_size[level]--;
+        file(node);
+        node = next;
+    }
+}
+
+int TimingWheel::next_occupied(int level, int slot) const {
+    for (int word = slot / 64; word < SLOTS / 64; ++word) {
+        uint64_t bits = occupied[level][word];
+        if (word == slot / 64)
+            bits &= ~0ULL << (slot % 64);
+        if (bits != 0)
+            return word * 64 + __builtin_ctzll(bits);
+    }
+    return -1;
+}
+
+void TimingWheel::advance_to(uint64_t tick) {
+    while (current_tick < tick) {
+        int lowest = 0;
+        while (lowest < LEVELS && level_size[lowest] == 0) {
+            lowest++;
+        }
+        if (lowest == LEVELS) {
+            current_tick = tick;
+            return;
+        }
+        // skip ticks in which nothing can happen: up to the next occupied
+        // slot of level 0, or to the next cascade of the lowest occupied
+        // level.
+        uint64_t next_event;
+        if (lowest == 0) {
+            int from = (current_tick & (SLOTS - 1)) + 1;
+            int slot = from < SLOTS ? next_occupied(0, from) : -1;
+            uint64_t rotation = current_tick & ~(uint64_t)(SLOTS - 1);
+            next_event = slot != -1 ? rotation + slot : rotation + SLOTS;
+        } else {
+            int shift = LEVEL_BITS * lowest;
+            next_event = ((current_tick >> shift) + 1) << shift;
+        }
+        current_tick = std::min(tick, next_event) - 1;
+
+        current_tick++;
+        for (int level = 1; level < LEVELS; ++level) {
+            if ((current_tick & ((1ULL << (LEVEL_BITS * level)) - 1)) != 0)
+                break;
+            cascade(level, (current_tick >> (LEVEL_BITS * level)) & (SLOTS - 1));
+        }
+        cascade(0, current_tick & (SLOTS - 1));
+    }
+}
+
+void TimingWheel::reserve(size_t num_slots) {
+    if (num_slots > nodes.size())
+        nodes.resize(num_slots);
+}
+
+void TimingWheel::insert(slot_t slot, time_point_t when) {
+    nodes[slot].deadline_tick = tick_at(when, true);
+    file(slot);
+    num_pending++;
+}
+
+void TimingWheel::remove(slot_t slot) {
+    unfile(slot);
+    num_pending--;
+}
+
+bool TimingWheel::pop_due(time_point_t now, slot_t& slot) {
+    advance_to(tick_at(now, false));
+    if (due.head == NONE)
+        return false;
+    slot = due.head;
+    unlink(due, due.head);
+    num_pending--;
+    return true;
+}
+
+TimerBackend::time_point_t TimingWheel::next_deadline() {
+    if (due.head != NONE)
+        return time_at(current_tick);
+    uint64_t earliest = UINT64_MAX;
+    for (int level = 0; level < LEVELS; ++level) {
+        if (level_size[level] == 0)
+            continue;
+        // the next slot of this level to come around; for level 0 that
+        // is a deadline, above it is when its timers move down a level.
+        int shift = LEVEL_BITS * level;
+        int index = (current_tick >> shift) & (SLOTS - 1);
+        int slot = index + 1 < SLOTS ? next_occupied(level, index + 1) : -1;
+        int distance = slot != -1 ? slot - index : next_occupied(level, 0) + SLOTS - index;
+        earliest = std::min(earliest, ((current_tick >> shift) + distance) << shift);
+    }
+    if (earliest == UINT64_MAX)
+        return time_point_t::max();
+    return time_at(earliest);
+}
+
+size_t TimingWheel::size() const {
+    return num_pending;
+}
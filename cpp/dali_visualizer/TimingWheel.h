@@ -0,0 +1,72 @@
+#ifndef DALI_VISUALIZER_TIMING_WHEEL_H
+#define DALI_VISUALIZER_TIMING_WHEEL_H
+
+#include <vector>
+
+#include "dali_visualizer/TimerBackend.h"
+
+// Hierarchical timing wheel (as in Varghese & Lauck): LEVELS wheels of
+// SLOTS buckets each, level L bucket covering SLOTS^L ticks. Insert and
+// cancel are O(1); a task is never run early and at most one resolution
+// late. Tasks due in the same tick run in insertion order.
+//
+// Timers further than SLOTS^LEVELS ticks away (~49 days at 1ms) park in
+// the last level and are re-filed when it comes around.
+class TimingWheel : public TimerBackend {
+    public:
+        static const int LEVEL_BITS = 8;
+        static const int SLOTS = 1 << LEVEL_BITS;
+        static const int LEVELS = 4;
+    private:
+        static const int32_t NONE = -1;
+        // one per pool slot, linked by index.
+        struct Node {
+            uint64_t deadline_tick;
+            int32_t prev;
+            int32_t next;
+            int level; // -1 when sitting in the due list
+            int slot;
+        };
+        struct List {
+            int32_t head = NONE;
+            int32_t tail = NONE;
+        };
+
+        const duration_t resolution;
+        const time_point_t origin;
+        uint64_t current_tick = 0;
+
+        List slots[LEVELS][SLOTS];
+        // bit s of occupied[level] is set iff slots[level][s] is non-empty.
+        uint64_t occupied[LEVELS][SLOTS / 64];
+        size_t level_size[LEVELS];
+        // deadline reached, waiting for pop_due.
+        List due;
+
+        std::vector<Node> nodes;
+        size_t num_pending = 0;
+
+        uint64_t tick_at(time_point_t when, bool round_up) const;
+        time_point_t time_at(uint64_t tick) const;
+
+        void append(List& list, int32_t node);
+        void unlink(List& list, int32_t node);
+
+        void file(int32_t node);
+        void unfile(int32_t node);
+        void cascade(int level, int slot);
+        void advance_to(uint64_t tick);
+        // first occupied slot of level at or after slot, or -1.
+        int next_occupied(int level, int slot) const;
+    public:
+        TimingWheel(duration_t resolution=std::chrono::milliseconds(1));
+
+        virtual void reserve(size_t num_slots) override;
+        virtual void insert(slot_t slot, time_point_t when) override;
+        virtual void remove(slot_t slot) override;
+        virtual bool pop_due(time_point_t now, slot_t& slot) override;
+        virtual time_point_t next_deadline() override;
+        virtual size_t size() const override;
+};
+
+#endif
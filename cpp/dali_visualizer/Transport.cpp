@@ -0,0 +1,319 @@
+#include "Transport.h"
+
+#include <algorithm>
+#include <iostream>
+#include <system_error>
+
+using std::placeholders::_1;
+
+namespace dali {
+    namespace visualizer {
+        Transport::~Transport() {
+        }
+
+        void Transport::set_connected_callback(std::function<void()> callback) {
+            connected_callback = callback;
+        }
+
+        /* RedisTransport */
+
+        RedisTransport::RedisTransport(std::string hostname_, int port_, std::string socket_path_) :
+                hostname(hostname_),
+                port(port_),
+                socket_path(socket_path_),
+                rdx_state(redox::Redox::DISCONNECTED),
+                subscriber_state(redox::Redox::DISCONNECTED) {
+        }
+
+        void RedisTransport::rdx_connected_callback(int status) {
+            rdx_state.store(status);
+            if (status == redox::Redox::CONNECTED && connected_callback)
+                connected_callback();
+        }
+
+        void RedisTransport::subscriber_connected_callback(int status) {
+            subscriber_state.store(status);
+        }
+
+        bool RedisTransport::ensure_publisher(bool& restarted) {
+            restarted = false;
+            try {
+                std::lock_guard<std::mutex> guard(connection_mutex);
+                if (rdx_state.load() != redox::Redox::CONNECTED &&
+                        rdx_state.load() != redox::Redox::NOT_YET_CONNECTED) {
+                    auto connection = std::make_shared<redox::Redox>(std::cout, redox::log::Off);
+                    std::atomic_store(&rdx, connection);
+                    rdx_state.store(redox::Redox::NOT_YET_CONNECTED);
+                    restarted = true;
+
+                    auto callback = std::bind(&RedisTransport::rdx_connected_callback, this, _1);
+                    if (socket_path.empty()) {
+                        connection->connect(hostname, port, callback);
+                    } else {
+                        connection->connectUnix(socket_path, callback);
+                    }
+                }
+                return rdx_state.load() == redox::Redox::CONNECTED;
+            } catch (const std::system_error&) {
+                return false;
+            }
+        }
+
+        bool RedisTransport::publisher_connected() {
+            return rdx_state.load() == redox::Redox::CONNECTED;
+        }
+
+        void RedisTransport::publish(const std::string& channel, const std::string& message) {
+            auto connection = std::atomic_load(&rdx);
+            if (connection != nullptr)
+                connection->publish(channel, message);
+        }
+
+        bool RedisTransport::flush() {
+            auto connection = std::atomic_load(&rdx);
+            if (connection == nullptr)
+                return false;
+            // redis answers the commands of a connection in order, so the
+            // reply to this one means every publish before it went through.
+            return connection->commandSync({"PING"});
+        }
+
+        bool RedisTransport::ensure_subscriber(bool& restarted) {
+            restarted = false;
+            try {
+                std::lock_guard<std::mutex> guard(connection_mutex);
+                if (subscriber_state.load() != redox::Redox::CONNECTED &&
+                        subscriber_state.load() != redox::Redox::NOT_YET_CONNECTED) {
+                    subscriber = std::make_shared<redox::Subscriber>(std::cout, redox::log::Off);
+                    subscriber_state.store(redox::Redox::NOT_YET_CONNECTED);
+                    restarted = true;
+
+                    auto callback = std::bind(&RedisTransport::subscriber_connected_callback, this, _1);
+                    if (socket_path.empty()) {
+                        subscriber->connect(hostname, port, callback);
+                    } else {
+                        subscriber->connectUnix(socket_path, callback);
+                    }
+                }
+                return subscriber_state.load() == redox::Redox::CONNECTED;
+            } catch (const std::system_error&) {
+                return false;
+            }
+        }
+
+        bool RedisTransport::subscriber_connected() {
+            return subscriber_state.load() == redox::Redox::CONNECTED;
+        }
+
+        std::shared_ptr<redox::Subscriber> RedisTransport::current_subscriber() {
+            std::lock_guard<std::mutex> guard(connection_mutex);
+            return subscriber;
+        }
+
+        void RedisTransport::subscribe(const std::string& channel, handler_t handler) {
+            auto connection = current_subscriber();
+            if (connection != nullptr)
+                connection->subscribe(channel, handler);
+        }
+
+        void RedisTransport::unsubscribe(const std::string& channel) {
+            auto connection = current_subscriber();
+            if (connection != nullptr)
+                connection->unsubscribe(channel);
+        }
+
+        std::set<std::string> RedisTransport::subscribed_topics() {
+            auto connection = current_subscriber();
+            if (connection == nullptr)
+                return std::set<std::string>();
+            return connection->subscribedTopics();
+        }
+
+        void RedisTransport::disconnect() {
+            std::lock_guard<std::mutex> guard(connection_mutex);
+            if (subscriber_state == redox::Redox::CONNECTED) {
+                subscriber->disconnect();
+            }
+            if (rdx_state == redox::Redox::CONNECTED) {
+                rdx->disconnect();
+            }
+        }
+
+        std::shared_ptr<Transport> redis_transport(std::string hostname, int port) {
+            return std::make_shared<RedisTransport>(hostname, port);
+        }
+
+        std::shared_ptr<Transport> redis_unix_transport(std::string socket_path) {
+            return std::make_shared<RedisTransport>("", 0, socket_path);
+        }
+
+        /* InProcessBroker */
+
+        InProcessBroker::InProcessBroker() : subscriptions(std::make_shared<subscriptions_t>()) {
+        }
+
+        InProcessBroker::subscription_t InProcessBroker::subscribe(const std::string& channel, handler_t handler) {
+            std::lock_guard<std::mutex> guard(broker_mutex);
+            auto updated = std::make_shared<subscriptions_t>(*subscriptions);
+            subscription_t id = next_subscription++;
+            auto delivery = std::make_shared<Delivery>();
+            delivery->handler = handler;
+            updated->push_back({id, channel, delivery});
+            subscriptions = updated;
+            return id;
+        }
+
+        // deliveries running on this thread, innermost last.
+        static thread_local std::vector<InProcessBroker::Delivery*> delivering;
+
+        void InProcessBroker::unsubscribe(subscription_t subscription) {
+            std::shared_ptr<Delivery> removed;
+            {
+                std::lock_guard<std::mutex> guard(broker_mutex);
+                auto updated = std::make_shared<subscriptions_t>();
+                for (auto& existing: *subscriptions) {
+                    if (existing.id != subscription) {
+                        updated->push_back(existing);
+                    } else {
+                        removed = existing.delivery;
+                    }
+                }
+                subscriptions = updated;
+            }
+            if (removed == nullptr)
+                return;
+            // publishers may still hold the old list; wait for the
+            // deliveries they started, but not for our own.
+            int own = (int)std::count(delivering.begin(), delivering.end(), removed.get());
+            std::unique_lock<std::mutex> lock(removed->delivery_mutex);
+            removed->active = false;
+            removed->drained.wait(lock, [&removed, own]() { return removed->in_flight == own; });
+        }
+
+        static void finish_delivery(InProcessBroker::Delivery& delivery) {
+            std::lock_guard<std::mutex> guard(delivery.delivery_mutex);
+            delivery.in_flight--;
+            delivery.drained.notify_all();
+        }
+
+        static bool channel_matches(const std::string& pattern, const std::string& channel) {
+            if (!pattern.empty() && pattern.back() == '*')
+                return channel.compare(0, pattern.size() - 1, pattern, 0, pattern.size() - 1) == 0;
+            return pattern == channel;
+        }
+
+        size_t InProcessBroker::publish(const std::string& channel, const std::string& message) {
+            std::shared_ptr<const subscriptions_t> current;
+            {
+                std::lock_guard<std::mutex> guard(broker_mutex);
+                current = subscriptions;
+            }
+            size_t receivers = 0;
+            for (auto& subscription: *current) {
+                if (!channel_matches(subscription.channel, channel))
+                    continue;
+                Delivery& delivery = *subscription.delivery;
+                {
+                    std::lock_guard<std::mutex> guard(delivery.delivery_mutex);
+                    if (!delivery.active)
+                        continue;
+                    delivery.in_flight++;
+                }
+                delivering.push_back(&delivery);
+                try {
+                    delivery.handler(channel, message);
+                } catch (...) {
+                    delivering.pop_back();
+                    finish_delivery(delivery);
+                    throw;
+                }
+                delivering.pop_back();
+                finish_delivery(delivery);
+                receivers++;
+            }
+            return receivers;
+        }
+
+        /* InProcessTransport */
+
+        InProcessTransport::InProcessTransport(std::shared_ptr<InProcessBroker> broker_) :
+                broker(broker_),
+                connected(false) {
+        }
+
+        InProcessTransport::~InProcessTransport() {
+            disconnect();
+        }
+
+        bool InProcessTransport::ensure_publisher(bool& restarted) {
+            restarted = !connected.exchange(true);
+            if (restarted && connected_callback)
+                connected_callback();
+            return true;
+        }
+
+        bool InProcessTransport::publisher_connected() {
+            return connected.load();
+        }
+
+        void InProcessTransport::publish(const std::string& channel, const std::string& message) {
+            broker->publish(channel, message);
+        }
+
+        bool InProcessTransport::flush() {
+            // publish delivers before it returns.
+            return true;
+        }
+
+        bool InProcessTransport::ensure_subscriber(bool& restarted) {
+            restarted = false;
+            return true;
+        }
+
+        bool InProcessTransport::subscriber_connected() {
+            return true;
+        }
+
+        void InProcessTransport::subscribe(const std::string& channel, handler_t handler) {
+            std::lock_guard<std::mutex> guard(subscriptions_mutex);
+            auto existing = subscriptions.find(channel);
+            if (existing != subscriptions.end())
+                broker->unsubscribe(existing->second);
+            subscriptions[channel] = broker->subscribe(channel, handler);
+        }
+
+        void InProcessTransport::unsubscribe(const std::string& channel) {
+            InProcessBroker::subscription_t subscription;
+            {
+                std::lock_guard<std::mutex> guard(subscriptions_mutex);
+                auto existing = subscriptions.find(channel);
+                if (existing == subscriptions.end())
+                    return;
+                subscription = existing->second;
+                subscriptions.erase(existing);
+            }
+            // outside the lock: a handler being drained may use us.
+            broker->unsubscribe(subscription);
+        }
+
+        std::set<std::string> InProcessTransport::subscribed_topics() {
+            std::lock_guard<std::mutex> guard(subscriptions_mutex);
+            std::set<std::string> topics;
+            for (auto& kv: subscriptions) {
+                topics.insert(kv.first);
+            }
+            return topics;
+        }
+
+        void InProcessTransport::disconnect() {
+            std::unordered_map<std::string, InProcessBroker::subscription_t> removed;
+            {
+                std::lock_guard<std::mutex> guard(subscriptions_mutex);
+                removed.swap(subscriptions);
+            }
+            for (auto& kv: removed) {
+                broker->unsubscribe(kv.second);
+            }
+        }
+    }
+}
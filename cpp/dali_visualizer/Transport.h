@@ -0,0 +1,162 @@
+#ifndef DALI_VISUALIZER_TRANSPORT_H
+#define DALI_VISUALIZER_TRANSPORT_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <redox.hpp>
+
+namespace dali {
+    namespace visualizer {
+        // Pub/sub connection used by Visualizer: one side publishes feed
+        // messages, the other receives callcenter requests. Both sides
+        // connect lazily through ensure_* and reconnect the same way
+        // after losing the connection.
+        class Transport {
+            public:
+                typedef std::function<void(const std::string& channel, const std::string& message)> handler_t;
+            protected:
+                std::function<void()> connected_callback;
+            public:
+                virtual ~Transport();
+
+                // Called whenever the publishing side comes up.
+                void set_connected_callback(std::function<void()> callback);
+
+                // Starts connecting the publishing side if it is down, in
+                // which case restarted is set. Returns whether it is up.
+                virtual bool ensure_publisher(bool& restarted) = 0;
+                // Whether the publishing side is up, without blocking.
+                virtual bool publisher_connected() = 0;
+                virtual void publish(const std::string& channel, const std::string& message) = 0;
+                // Blocks until the broker has taken everything published
+                // so far. Returns false if that cannot be confirmed.
+                virtual bool flush() = 0;
+
+                // Same for the subscribing side.
+                virtual bool ensure_subscriber(bool& restarted) = 0;
+                virtual bool subscriber_connected() = 0;
+                virtual void subscribe(const std::string& channel, handler_t handler) = 0;
+                virtual void unsubscribe(const std::string& channel) = 0;
+                virtual std::set<std::string> subscribed_topics() = 0;
+
+                virtual void disconnect() = 0;
+        };
+
+        // Redis through redox, over TCP or a Unix domain socket (which
+        // skips the loopback network stack).
+        class RedisTransport : public Transport {
+            private:
+                const std::string hostname;
+                const int port;
+                // connects over this socket when non-empty.
+                const std::string socket_path;
+
+                std::mutex connection_mutex;
+                // swapped with atomic_store so publish does not need the
+                // connection_mutex.
+                std::shared_ptr<redox::Redox> rdx;
+                std::shared_ptr<redox::Subscriber> subscriber;
+                std::atomic<int> rdx_state;
+                std::atomic<int> subscriber_state;
+
+                void rdx_connected_callback(int status);
+                void subscriber_connected_callback(int status);
+                std::shared_ptr<redox::Subscriber> current_subscriber();
+            public:
+                RedisTransport(std::string hostname, int port, std::string socket_path="");
+
+                virtual bool ensure_publisher(bool& restarted) override;
+                virtual bool publisher_connected() override;
+                virtual void publish(const std::string& channel, const std::string& message) override;
+                virtual bool flush() override;
+                virtual bool ensure_subscriber(bool& restarted) override;
+                virtual bool subscriber_connected() override;
+                virtual void subscribe(const std::string& channel, handler_t handler) override;
+                virtual void unsubscribe(const std::string& channel) override;
+                virtual std::set<std::string> subscribed_topics() override;
+                virtual void disconnect() override;
+        };
+
+        std::shared_ptr<Transport> redis_transport(std::string hostname="127.0.0.1", int port=6379);
+        // e.g. redis_unix_transport("/tmp/redis.sock"), with unixsocket
+        // set in redis.conf.
+        std::shared_ptr<Transport> redis_unix_transport(std::string socket_path);
+
+        // Pub/sub between threads of one process, for consumers living
+        // next to the client (and for tests and benchmarks). publish runs
+        // the subscribers' handlers on the publishing thread. A channel
+        // ending in '*' subscribes to every channel with that prefix.
+        class InProcessBroker {
+            public:
+                typedef Transport::handler_t handler_t;
+                typedef uint64_t subscription_t;
+
+                // Handler of a subscription and the deliveries to it that
+                // are under way.
+                struct Delivery {
+                    handler_t handler;
+                    std::mutex delivery_mutex;
+                    std::condition_variable drained;
+                    bool active = true;
+                    int in_flight = 0;
+                };
+            private:
+                struct Subscription {
+                    subscription_t id;
+                    std::string channel;
+                    std::shared_ptr<Delivery> delivery;
+                };
+                typedef std::vector<Subscription> subscriptions_t;
+
+                std::mutex broker_mutex;
+                subscription_t next_subscription = 0;
+                // copied on write, so publish only holds the lock to
+                // take a reference.
+                std::shared_ptr<const subscriptions_t> subscriptions;
+            public:
+                InProcessBroker();
+
+                subscription_t subscribe(const std::string& channel, handler_t handler);
+                // Once this returns the handler is not running (except
+                // on the calling thread, if it unsubscribes from within
+                // the handler) and is not called again.
+                void unsubscribe(subscription_t subscription);
+                // Returns how many subscribers got the message.
+                size_t publish(const std::string& channel, const std::string& message);
+        };
+
+        class InProcessTransport : public Transport {
+            private:
+                std::shared_ptr<InProcessBroker> broker;
+                std::mutex subscriptions_mutex;
+                std::unordered_map<std::string, InProcessBroker::subscription_t> subscriptions;
+                std::atomic<bool> connected;
+            public:
+                InProcessTransport(std::shared_ptr<InProcessBroker> broker);
+                ~InProcessTransport();
+
+                virtual bool ensure_publisher(bool& restarted) override;
+                virtual bool publisher_connected() override;
+                virtual void publish(const std::string& channel, const std::string& message) override;
+                virtual bool flush() override;
+                virtual bool ensure_subscriber(bool& restarted) override;
+                virtual bool subscriber_connected() override;
+                virtual void subscribe(const std::string& channel, handler_t handler) override;
+                virtual void unsubscribe(const std::string& channel) override;
+                virtual std::set<std::string> subscribed_topics() override;
+                // Returns once no handler of ours runs on another thread, so
+                // whatever they use can be destroyed right after.
+                virtual void disconnect() override;
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,42 @@
+#include "Vocabulary.h"
+
+using json11::Json;
+
+namespace dali {
+    namespace visualizer {
+        Vocabulary::Vocabulary(int id_, std::string name_, std::vector<std::string> words_) :
+                id(id_),
+                name(name_),
+                words(words_) {
+            word_to_index.reserve(words.size());
+            for (size_t i = 0; i < words.size(); ++i) {
+                // first occurrence wins for duplicated words.
+                word_to_index.emplace(words[i], (int)i);
+            }
+        }
+
+        int Vocabulary::index(const std::string& word) const {
+            auto it = word_to_index.find(word);
+            return it == word_to_index.end() ? -1 : it->second;
+        }
+
+        bool Vocabulary::indices(const std::vector<std::string>& words, std::vector<int>& indices) const {
+            indices.resize(words.size());
+            for (size_t i = 0; i < words.size(); ++i) {
+                indices[i] = index(words[i]);
+                if (indices[i] == -1)
+                    return false;
+            }
+            return true;
+        }
+
+        Json Vocabulary::to_json() const {
+            return Json::object {
+                { "type", "vocabulary" },
+                { "id", id },
+                { "name", name },
+                { "words", words },
+            };
+        }
+    }
+}
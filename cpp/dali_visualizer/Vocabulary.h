@@ -0,0 +1,40 @@
+#ifndef DALI_VISUALIZER_VOCABULARY_H
+#define DALI_VISUALIZER_VOCABULARY_H
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <json11.hpp>
+
+namespace dali {
+    namespace visualizer {
+        // A list of words/labels published once under an id (see
+        // Visualizer::register_vocabulary), so later messages can refer to
+        // them by index instead of repeating the strings.
+        class Vocabulary {
+            private:
+                std::unordered_map<std::string, int> word_to_index;
+            public:
+                const int id;
+                const std::string name;
+                const std::vector<std::string> words;
+
+                Vocabulary(int id, std::string name, std::vector<std::string> words);
+
+                // Index of word, or -1 if it is not in the vocabulary.
+                int index(const std::string& word) const;
+
+                // Indices of all words; returns false (and leaves the rest
+                // of indices unspecified) if any of them is missing.
+                bool indices(const std::vector<std::string>& words, std::vector<int>& indices) const;
+
+                // {"type": "vocabulary", "id": .., "name": .., "words": [..]}
+                json11::Json to_json() const;
+        };
+
+        typedef std::shared_ptr<const Vocabulary> vocabulary_ptr;
+    }
+}
+
+#endif
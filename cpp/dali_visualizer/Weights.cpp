@@ -0,0 +1,84 @@
+#include "Weights.h"
+
+namespace dali {
+    namespace visualizer {
+        template<typename R>
+        Weights<R>::Weights(const std::vector<R>& weights) : owned(weights) {
+        }
+
+        template<typename R>
+        Weights<R>::Weights(std::vector<R>&& weights) : owned(std::move(weights)) {
+        }
+
+        template<typename R>
+        Weights<R>::Weights(const Mat<R>& weights) : mat(weights), from_mat(true) {
+        }
+
+        template<typename R>
+        Weights<R>& Weights<R>::operator=(const std::vector<R>& weights) {
+            owned = weights;
+            mat = Mat<R>();
+            from_mat = false;
+            return *this;
+        }
+
+        template<typename R>
+        Weights<R>& Weights<R>::operator=(std::vector<R>&& weights) {
+            owned = std::move(weights);
+            mat = Mat<R>();
+            from_mat = false;
+            return *this;
+        }
+
+        template<typename R>
+        Weights<R>& Weights<R>::operator=(const Mat<R>& weights) {
+            owned.clear();
+            mat = weights;
+            from_mat = true;
+            return *this;
+        }
+
+        template<typename R>
+        const R* Weights<R>::data() const {
+            return from_mat ? mat.w().data() : owned.data();
+        }
+
+        template<typename R>
+        size_t Weights<R>::size() const {
+            return from_mat ? mat.number_of_elements() : owned.size();
+        }
+
+        template<typename R>
+        bool Weights<R>::empty() const {
+            return size() == 0;
+        }
+
+        template<typename R>
+        bool Weights<R>::shares_storage() const {
+            return from_mat;
+        }
+
+        template<typename R>
+        const R* Weights<R>::begin() const {
+            return data();
+        }
+
+        template<typename R>
+        const R* Weights<R>::end() const {
+            return data() + size();
+        }
+
+        template<typename R>
+        const R& Weights<R>::operator[](size_t idx) const {
+            return data()[idx];
+        }
+
+        template<typename R>
+        std::vector<R> Weights<R>::to_vector() const {
+            return std::vector<R>(begin(), end());
+        }
+
+        template class Weights<float>;
+        template class Weights<double>;
+    }
+}
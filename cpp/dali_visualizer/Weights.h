@@ -0,0 +1,49 @@
+#ifndef DALI_VISUALIZER_WEIGHTS_H
+#define DALI_VISUALIZER_WEIGHTS_H
+
+#include <dali/tensor/Mat.h>
+#include <vector>
+
+namespace dali {
+    namespace visualizer {
+        // Weights attached to a visualizable. Assigning a Mat<R> does not
+        // copy anything: the Mat shares its storage, and the numbers are
+        // only read when the visualizable is serialized. So in-place updates
+        // to the Mat made before that point are visible in the output.
+        // Assigning a std::vector<R> keeps a copy.
+        template<typename R>
+        class Weights {
+            private:
+                std::vector<R> owned;
+                Mat<R> mat;
+                bool from_mat = false;
+            public:
+                typedef R value_type;
+                typedef const R* const_iterator;
+
+                Weights() = default;
+                Weights(const std::vector<R>& weights);
+                Weights(std::vector<R>&& weights);
+                Weights(const Mat<R>& weights);
+
+                Weights& operator=(const std::vector<R>& weights);
+                Weights& operator=(std::vector<R>&& weights);
+                Weights& operator=(const Mat<R>& weights);
+
+                const R* data() const;
+                size_t size() const;
+                bool empty() const;
+                // true when assigned a Mat, whose numbers may change at
+                // any time.
+                bool shares_storage() const;
+
+                const R* begin() const;
+                const R* end() const;
+                const R& operator[](size_t idx) const;
+
+                std::vector<R> to_vector() const;
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,55 @@
+#include "WireFormat.h"
+
+#include <cstdint>
+#include <cstring>
+#include <zlib.h>
+
+namespace dali {
+    namespace visualizer {
+        const char* const BINARY_FRAME_MAGIC = "DVB1";
+        const char* const BINARY_FORMAT_NAME = "dvb1";
+        const char* const COMPRESSED_FRAME_MAGIC = "DVZ1";
+
+        static void append_u32(std::string& out, uint32_t number) {
+            for (int byte = 0; byte < 4; ++byte) {
+                out += static_cast<char>((number >> (8 * byte)) & 0xff);
+            }
+        }
+
+        void encode_message(const JsonWriter& writer, WireFormat format, std::string& out) {
+            if (format == WireFormat::JSON || writer.blocks().empty()) {
+                out.assign(writer.str());
+                return;
+            }
+            const std::string& json = writer.str();
+            const uint32_t json_length = json.size();
+
+            out.clear();
+            out.reserve(8 + json.size() + writer.blocks().size());
+            out.append(BINARY_FRAME_MAGIC, 4);
+            append_u32(out, json_length);
+            out += json;
+            out += writer.blocks();
+        }
+
+        bool is_binary_frame(const std::string& payload) {
+            return payload.size() >= 8 && payload.compare(0, 4, BINARY_FRAME_MAGIC) == 0;
+        }
+
+        bool compress_message(const std::string& payload, int level, std::string& out) {
+            uLongf compressed_length = compressBound(payload.size());
+            out.resize(8 + compressed_length);
+            out.replace(0, 4, COMPRESSED_FRAME_MAGIC, 4);
+            for (int byte = 0; byte < 4; ++byte) {
+                out[4 + byte] = static_cast<char>((payload.size() >> (8 * byte)) & 0xff);
+            }
+            int status = compress2(reinterpret_cast<Bytef*>(&out[8]), &compressed_length,
+                                   reinterpret_cast<const Bytef*>(payload.data()), payload.size(),
+                                   level);
+            if (status != Z_OK || 8 + compressed_length >= payload.size())
+                return false;
+            out.resize(8 + compressed_length);
+            return true;
+        }
+    }
+}
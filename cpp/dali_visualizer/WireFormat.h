@@ -0,0 +1,48 @@
+#ifndef DALI_VISUALIZER_WIRE_FORMAT_H
+#define DALI_VISUALIZER_WIRE_FORMAT_H
+
+#include <string>
+
+#include "dali_visualizer/JsonWriter.h"
+
+namespace dali {
+    namespace visualizer {
+        // Encoding of messages published on the updates channel.
+        //
+        // JSON   - plain JSON text, understood by every server.
+        // BINARY - used only after the server lists "dvb1" in a
+        //          "wire_formats" callcenter request. A frame is
+        //
+        //              "DVB1" | u32 json length | json | float32 blocks
+        //
+        //          where all integers and floats are little-endian. Every
+        //          numeric array in the JSON is replaced by a placeholder
+        //          {"__f32__": n}, and its n floats follow in the block
+        //          section, in document order. Messages without numeric
+        //          arrays are still sent as plain JSON text.
+        enum class WireFormat {
+            JSON,
+            BINARY
+        };
+
+        extern const char* const BINARY_FRAME_MAGIC;
+        extern const char* const BINARY_FORMAT_NAME;
+        extern const char* const COMPRESSED_FRAME_MAGIC;
+
+        // Writes writer's contents as a message in the given format.
+        void encode_message(const JsonWriter& writer, WireFormat format, std::string& out);
+
+        bool is_binary_frame(const std::string& payload);
+
+        // Wraps an encoded message (JSON text or binary frame) as
+        //
+        //     "DVZ1" | u32 uncompressed length | zlib stream
+        //
+        // level is a zlib level (1 fastest ... 9 smallest, -1 default).
+        // Returns false, leaving out unspecified, if compression fails or
+        // does not make the message smaller.
+        bool compress_message(const std::string& payload, int level, std::string& out);
+    }
+}
+
+#endif
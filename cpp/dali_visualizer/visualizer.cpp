@@ -1,7 +1,12 @@
 #include "visualizer.h"
 
+#include <algorithm>
+#include <cstring>
 #include <memory>
 #include <future>
+#include <iostream>
+#include <random>
+#include <stdexcept>
 #include <sole.hpp>
 
 #include "dali/utils/core_utils.h"
@@ -24,6 +29,56 @@ namespace dali {
         typedef std::shared_ptr<Visualizable> visualizable_ptr;
         typedef std::shared_ptr<GridLayout> grid_layout_ptr;
 
+        static std::atomic<uint64_t> next_version(1);
+
+        // Folds value into a content version; anything VOLATILE makes the
+        // result VOLATILE.
+        static uint64_t mix_version(uint64_t seed, uint64_t value) {
+            if (seed == Visualizable::VOLATILE || value == Visualizable::VOLATILE)
+                return Visualizable::VOLATILE;
+            seed ^= value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2);
+            return seed == Visualizable::VOLATILE ? 1 : seed;
+        }
+
+        static uint64_t mix_version(uint64_t seed, const std::string& value) {
+            return mix_version(seed, std::hash<std::string>()(value) | 1);
+        }
+
+        const uint64_t Visualizable::VOLATILE;
+
+        Visualizable::Visualizable() : version(next_version++) {
+        }
+
+        Visualizable::~Visualizable() {
+        }
+
+        void Visualizable::write_json(JsonWriter& writer) {
+            writer.value(to_json());
+        }
+
+        uint64_t Visualizable::content_version() {
+            return VOLATILE;
+        }
+
+        void Visualizable::mark_changed() {
+            version = next_version++;
+        }
+
+        // Indices of the k largest values, largest first (ties go to the
+        // lower index). Heap-based partial sort: O(n log k).
+        template<typename R>
+        static std::vector<size_t> top_k_indices(const R* values, size_t n, size_t k) {
+            k = std::min(k, n);
+            std::vector<size_t> indices(n);
+            for (size_t i = 0; i < n; ++i) indices[i] = i;
+            std::partial_sort(indices.begin(), indices.begin() + k, indices.end(),
+                    [values](size_t a, size_t b) {
+                return values[a] > values[b] || (values[a] == values[b] && a < b);
+            });
+            indices.resize(k);
+            return indices;
+        }
+
         template<typename R>
         std::vector<std::shared_ptr<Sentence<R>>> sentence_vector(const std::vector<std::vector<std::string>>& vec) {
             std::vector<std::shared_ptr<Sentence<R>>> res;
@@ -44,13 +99,24 @@ namespace dali {
         template<typename R>
         void Sentence<R>::set_weights(const std::vector<R>& _weights) {
             weights = _weights;
+            this->mark_changed();
         }
 
         template<typename R>
         void Sentence<R>::set_weights(const Mat<R>& _weights) {
-            weights = std::vector<R>(
-                _weights.w().data(),
-                _weights.w().data() + _weights.number_of_elements());
+            weights = _weights;
+            this->mark_changed();
+        }
+
+        template<typename R>
+        uint64_t Sentence<R>::content_version() {
+            if (weights.shares_storage())
+                return VOLATILE;
+            // sizes and the vocabulary catch the usual direct edits.
+            uint64_t result = mix_version(this->version, tokens.size());
+            result = mix_version(result, weights.size() + 1);
+            result = mix_version(result, (uint64_t)(uintptr_t)vocabulary.get() + spaces);
+            return result;
         }
 
         template<typename R>
@@ -63,6 +129,22 @@ namespace dali {
             };
         }
 
+        template<typename R>
+        void Sentence<R>::write_json(JsonWriter& writer) {
+            writer.begin_object()
+                  .key("type").value("sentence")
+                  .key("weights").number_array(weights.data(), weights.size());
+            thread_local std::vector<int> word_ids;
+            if (vocabulary != nullptr && vocabulary->indices(tokens, word_ids)) {
+                writer.key("vocabulary").value(vocabulary->id)
+                      .key("word_ids").int_array(word_ids);
+            } else {
+                writer.key("words").string_array(tokens);
+            }
+            writer.key("spaces").value(this->spaces)
+                  .end_object();
+        }
+
         template class Sentence<float>;
         template class Sentence<double>;
 
@@ -78,13 +160,24 @@ namespace dali {
         template<typename R>
         void Sentences<R>::set_weights(const std::vector<R>& _weights) {
             weights = _weights;
+            this->mark_changed();
         }
 
         template<typename R>
         void Sentences<R>::set_weights(const Mat<R>& _weights) {
-            weights = std::vector<R>(
-                _weights.w().data(),
-                _weights.w().data() + _weights.number_of_elements());
+            weights = _weights;
+            this->mark_changed();
+        }
+
+        template<typename R>
+        uint64_t Sentences<R>::content_version() {
+            if (weights.shares_storage())
+                return VOLATILE;
+            uint64_t result = mix_version(this->version, weights.size() + 1);
+            for (auto& sentence: sentences) {
+                result = mix_version(result, sentence->content_version());
+            }
+            return result;
         }
 
         template<typename R>
@@ -101,6 +194,21 @@ namespace dali {
             };
         };
 
+        template<typename R>
+        void ParallelSentence<R>::write_json(JsonWriter& writer) {
+            writer.begin_object()
+                  .key("type").value("parallel_sentence")
+                  .key("sentence1").child(*sentence1, "sentence1")
+                  .key("sentence2").child(*sentence2, "sentence2")
+                  .end_object();
+        }
+
+        template<typename R>
+        uint64_t ParallelSentence<R>::content_version() {
+            uint64_t result = mix_version(this->version, sentence1->content_version());
+            return mix_version(result, sentence2->content_version());
+        }
+
         template class ParallelSentence<float>;
         template class ParallelSentence<double>;
 
@@ -118,6 +226,17 @@ namespace dali {
             };
         }
 
+        template<typename R>
+        void Sentences<R>::write_json(JsonWriter& writer) {
+            writer.begin_object()
+                  .key("type").value("sentences")
+                  .key("weights").number_array(weights.data(), weights.size())
+                  .key("sentences").begin_array()
+                  .children(sentences, "sentences")
+                  .end_array()
+                  .end_object();
+        }
+
         template class Sentences<float>;
         template class Sentences<double>;
 
@@ -138,6 +257,23 @@ namespace dali {
             };
         }
 
+        template<typename R>
+        void QA<R>::write_json(JsonWriter& writer) {
+            writer.begin_object()
+                  .key("type").value("qa")
+                  .key("context").child(*context, "context")
+                  .key("question").child(*question, "question")
+                  .key("answer").child(*answer, "answer")
+                  .end_object();
+        }
+
+        template<typename R>
+        uint64_t QA<R>::content_version() {
+            uint64_t result = mix_version(this->version, context->content_version());
+            result = mix_version(result, question->content_version());
+            return mix_version(result, answer->content_version());
+        }
+
         template class QA<float>;
         template class QA<double>;
 
@@ -147,6 +283,18 @@ namespace dali {
             while (grid.size() <= column)
                 grid.emplace_back();
             grid[column].push_back(vis);
+            mark_changed();
+        }
+
+        uint64_t GridLayout::content_version() {
+            uint64_t result = version;
+            for (auto& column: grid) {
+                result = mix_version(result, column.size() + 1);
+                for (auto& vis: column) {
+                    result = mix_version(result, vis->content_version());
+                }
+            }
+            return result;
         }
 
         json11::Json GridLayout::to_json() {
@@ -164,6 +312,19 @@ namespace dali {
             };
         }
 
+        void GridLayout::write_json(JsonWriter& writer) {
+            writer.begin_object()
+                  .key("type").value("grid_layout")
+                  .key("grid").begin_array();
+            for (size_t column = 0; column < grid.size(); ++column) {
+                writer.begin_array()
+                      .children(grid[column], "grid", (int)column)
+                      .end_array();
+            }
+            writer.end_array()
+                  .end_object();
+        }
+
         /** Finite Distribution **/
         template<typename R>
         FiniteDistribution<R>::FiniteDistribution(
@@ -193,30 +354,23 @@ namespace dali {
                 labels,
                 max_top_picks) {}
 
+        template<typename R>
+        std::vector<size_t> FiniteDistribution<R>::top_pick_indices() const {
+            return top_k_indices(distribution.data(), distribution.size(), top_picks);
+        }
+
         template<typename R>
         json11::Json FiniteDistribution<R>::to_json() {
             std::vector<std::string> output_labels(top_picks);
             std::vector<double> output_probs(top_picks);
             std::vector<double> output_scores(top_picks);
 
-            // Pick top k best answers;
-
-            std::vector<bool> taken(distribution.size());
-            for(int idx = 0; idx < distribution.size(); ++idx) taken[idx] = false;
-
+            auto picks = top_pick_indices();
             for(int iters = 0; iters < top_picks; ++iters) {
-                int best_index = -1;
-                for (int i=0; i < distribution.size(); ++i) {
-                    if (taken[i]) continue;
-                    if (best_index == -1 || distribution[i] > distribution[best_index]) best_index = i;
-                }
-                assert2(best_index != -1, "Szymon fucked up");
-
-                taken[best_index] = true;
-                output_probs[iters] = distribution[best_index];
-                output_labels[iters] = labels[best_index];
+                output_probs[iters] = distribution[picks[iters]];
+                output_labels[iters] = labels[picks[iters]];
                 if (!scores.empty())
-                    output_scores[iters] = scores[best_index];
+                    output_scores[iters] = scores[picks[iters]];
             }
             if (scores.empty()) {
                 return Json::object {
@@ -234,6 +388,47 @@ namespace dali {
             }
         }
 
+        template<typename R>
+        void FiniteDistribution<R>::write_json(JsonWriter& writer) {
+            auto picks = top_pick_indices();
+            std::vector<R> picked(picks.size());
+
+            writer.begin_object()
+                  .key("type").value("finite_distribution");
+            if (!scores.empty()) {
+                for (size_t i = 0; i < picks.size(); ++i) picked[i] = scores[picks[i]];
+                writer.key("scores").number_array(picked);
+            }
+            for (size_t i = 0; i < picks.size(); ++i) picked[i] = distribution[picks[i]];
+            writer.key("probabilities").number_array(picked);
+
+            thread_local std::vector<int> label_ids;
+            bool interned = vocabulary != nullptr;
+            label_ids.resize(picks.size());
+            for (size_t i = 0; interned && i < picks.size(); ++i) {
+                label_ids[i] = vocabulary->index(labels[picks[i]]);
+                interned = label_ids[i] != -1;
+            }
+            if (interned) {
+                writer.key("vocabulary").value(vocabulary->id)
+                      .key("label_ids").int_array(label_ids);
+            } else {
+                writer.key("labels").begin_array();
+                for (auto idx: picks) writer.value(labels[idx]);
+                writer.end_array();
+            }
+            writer.end_object();
+        }
+
+        template<typename R>
+        uint64_t FiniteDistribution<R>::content_version() {
+            uint64_t result = mix_version(this->version, distribution.size() + 1);
+            result = mix_version(result, scores.size() + 1);
+            result = mix_version(result, labels.size() + 1);
+            result = mix_version(result, (uint64_t)(uintptr_t)vocabulary.get() + top_picks);
+            return result;
+        }
+
         template class FiniteDistribution<float>;
         template class FiniteDistribution<double>;
 
@@ -252,6 +447,22 @@ namespace dali {
             };
         }
 
+        template<typename T>
+        void Probability<T>::write_json(JsonWriter& writer) {
+            writer.begin_object()
+                  .key("type").value("probability")
+                  .key("probability").value(probability)
+                  .end_object();
+        }
+
+        template<typename T>
+        uint64_t Probability<T>::content_version() {
+            double value = probability;
+            uint64_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            return mix_version(this->version, bits | 1);
+        }
+
         template class Probability<float>;
         template class Probability<double>;
 
@@ -265,6 +476,17 @@ namespace dali {
             };
         }
 
+        void Message::write_json(JsonWriter& writer) {
+            writer.begin_object()
+                  .key("type").value("message")
+                  .key("content").value(content)
+                  .end_object();
+        }
+
+        uint64_t Message::content_version() {
+            return mix_version(version, content);
+        }
+
         Tree::Tree(string label) :
                 label(label) {
         }
@@ -311,24 +533,61 @@ namespace dali {
             }
         }
 
+        void Tree::write_json(JsonWriter& writer) {
+            writer.begin_object()
+                  .key("type").value("tree");
+            if (!label.empty()) {
+                writer.key("label").value(label);
+            }
+            writer.key("children").begin_array()
+                  .children(children, "children")
+                  .end_array()
+                  .end_object();
+        }
+
+        uint64_t Tree::content_version() {
+            uint64_t result = mix_version(version, label);
+            result = mix_version(result, children.size() + 1);
+            for (auto& child: children) {
+                result = mix_version(result, child->content_version());
+            }
+            return result;
+        }
+
         template<typename R>
         json11::Json json_finite_distribution(
             const Mat<R>& probs,
-            const vector<string>& labels) {
+            const vector<string>& labels,
+            int max_top_picks) {
             assert2(probs.dims(1) == 1, MS() << "Probabilities must be a column vector");
-            vector<R> distribution(probs.w().data(), probs.w().data() + probs.dims(0));
+            const R* data = probs.w().data();
+            if (max_top_picks <= 0 || max_top_picks >= probs.dims(0)) {
+                return json11::Json::object {
+                    { "type", "finite_distribution"},
+                    { "probabilities", Json::array(data, data + probs.dims(0)) },
+                    { "labels", labels },
+                };
+            }
+            assert2(labels.size() == (size_t)probs.dims(0),
+                    "json_finite_distribution: sizes of labels and probabilities differ");
+            Json::array top_probs;
+            Json::array top_labels;
+            for (auto idx: top_k_indices(data, probs.dims(0), max_top_picks)) {
+                top_probs.emplace_back(data[idx]);
+                top_labels.emplace_back(labels[idx]);
+            }
             return json11::Json::object {
                 { "type", "finite_distribution"},
-                { "probabilities", distribution },
-                { "labels", labels },
+                { "probabilities", top_probs },
+                { "labels", top_labels },
             };
         }
 
-        template json11::Json json_finite_distribution(const Mat<float>&, const vector<string>&);
-        template json11::Json json_finite_distribution(const Mat<double>&, const vector<string>&);
+        template json11::Json json_finite_distribution(const Mat<float>&, const vector<string>&, int);
+        template json11::Json json_finite_distribution(const Mat<double>&, const vector<string>&, int);
 
         template<typename R>
-        Json json_classification(const vector<string>& sentence, const Mat<R>& probs, const vector<string>& label_names) {
+        Json json_classification(const vector<string>& sentence, const Mat<R>& probs, const vector<string>& label_names, int max_top_picks) {
             // store sentence memory & tokens:
             auto sentence_viz = Sentence<R>(sentence);
 
@@ -336,17 +595,17 @@ namespace dali {
             Json::object json_example = {
                 { "type", "classifier_example"},
                 { "input", sentence_viz.to_json()},
-                { "output",  json_finite_distribution(probs, label_names) },
+                { "output",  json_finite_distribution(probs, label_names, max_top_picks) },
             };
 
             return json_example;
         }
 
-        template Json json_classification<float>(const vector<string>& sentence, const Mat<float>& probs, const vector<string>& label_names);
-        template Json json_classification<double>(const vector<string>& sentence, const Mat<double>& probs, const vector<string>& label_names);
+        template Json json_classification<float>(const vector<string>& sentence, const Mat<float>& probs, const vector<string>& label_names, int max_top_picks);
+        template Json json_classification<double>(const vector<string>& sentence, const Mat<double>& probs, const vector<string>& label_names, int max_top_picks);
 
         template<typename R>
-        Json json_classification(const vector<string>& sentence, const Mat<R>& probs, const Mat<R>& word_weights, const vector<string>& label_names) {
+        Json json_classification(const vector<string>& sentence, const Mat<R>& probs, const Mat<R>& word_weights, const vector<string>& label_names, int max_top_picks) {
 
             // store sentence memory & tokens:
             auto sentence_viz = Sentence<R>(sentence);
@@ -356,115 +615,208 @@ namespace dali {
             Json::object json_example = {
                 { "type", "classifier_example"},
                 { "input", sentence_viz.to_json()},
-                { "output",  json_finite_distribution(probs, label_names) },
+                { "output",  json_finite_distribution(probs, label_names, max_top_picks) },
             };
 
             return json_example;
         }
 
-        template Json json_classification<float>(const vector<string>& sentence, const Mat<float>& probs, const Mat<float>& word_weights, const vector<string>& label_names);
-        template Json json_classification<double>(const vector<string>& sentence, const Mat<double>& probs, const Mat<double>& word_weights, const vector<string>& label_names);
+        template Json json_classification<float>(const vector<string>& sentence, const Mat<float>& probs, const Mat<float>& word_weights, const vector<string>& label_names, int max_top_picks);
+        template Json json_classification<double>(const vector<string>& sentence, const Mat<double>& probs, const Mat<double>& word_weights, const vector<string>& label_names, int max_top_picks);
 
 
 
         bool Visualizer::ensure_connection() {
-            try {
-                std::unique_lock<std::mutex> guard(connection_mutex);
-                if (rdx_state.load() != redox::Redox::CONNECTED &&
-                        rdx_state.load() != redox::Redox::NOT_YET_CONNECTED) {
-                    rdx.reset();
-
-                    rdx = std::make_shared<redox::Redox>(std::cout, redox::log::Off);
-
-
-                    rdx_state.store(redox::Redox::NOT_YET_CONNECTED);
-
-                    rdx->connect(hostname, port,
-                                 std::bind(&Visualizer::rdx_connected_callback, this, _1));
-                }
-
-                if (callcenter_state.load() != redox::Redox::CONNECTED &&
-                        callcenter_state.load() != redox::Redox::NOT_YET_CONNECTED) {
-                    subscription_active = false;
-                    callcenter_main_phoneline.reset();
-                    callcenter_main_phoneline =
-                            std::make_shared<redox::Subscriber>(std::cout, redox::log::Off);
-                    callcenter_main_phoneline->connect(
-                        hostname, port,
-                        std::bind(&Visualizer::callcenter_connected_callback, this, _1));
-                }
-
-                return rdx_state.load() == redox::Redox::CONNECTED;
-            } catch (std::system_error) {
-                return false;
+            std::lock_guard<std::mutex> guard(connection_mutex);
+            bool restarted;
+            bool connected = transport->ensure_publisher(restarted);
+            if (restarted) {
+                client_stats.connection_attempts++;
+                // a (re)started server has to advertise its formats again.
+                wire_format.store((int)WireFormat::JSON);
+                vocabularies_synced.store(false);
             }
+            transport->ensure_subscriber(restarted);
+            if (restarted) {
+                subscription_active = false;
+            }
+            return connected;
         }
 
-        void Visualizer::rdx_connected_callback(int status) {
-            rdx_state.store(status);
+        Visualizer::Visualizer(std::string name_, std::string hostname_, int port_) :
+                Visualizer(name_, hostname_, port_, redis_transport(hostname_, port_)) {
         }
 
-        void Visualizer::callcenter_connected_callback(int status) {
-            callcenter_state.store(status);
+        Visualizer::Visualizer(std::string name_, std::shared_ptr<Transport> transport_) :
+                Visualizer(name_, "", 0, transport_) {
         }
 
-        Visualizer::Visualizer(std::string name_, std::string hostname_, int port_) :
+        // requests handled at the same time.
+        static const int CALLCENTER_WORKERS = 4;
+
+        Visualizer::Visualizer(std::string name_, std::string hostname_, int port_,
+                               std::shared_ptr<Transport> transport_) :
                 my_uuid(sole::uuid4().str()),
                 my_name(name_),
+                updates_channel("updates_" + my_uuid),
+                transport(transport_),
                 hostname(hostname_),
                 port(port_),
                 running(true),
-                rdx_state(redox::Redox::DISCONNECTED),
-                callcenter_state(redox::Redox::DISCONNECTED)  {
+                publisher_up(false),
+                reconnect_requested(false),
+                feed_queue(nullptr),
+                batch_window_ns(0),
+                max_batch_bytes(0),
+                batch_mode((int)BatchMode::PIPELINED),
+                fragment_cache_enabled(false),
+                number_precision(NumberFormat().precision),
+                keep_float32(NumberFormat().keep_float32),
+                compression_threshold(0),
+                compression_level(1),
+                wire_format((int)WireFormat::JSON),
+                vocabularies_synced(false),
+                publish_latency_ns(0),
+                callcenter([this](const Json& reply) { feed(reply); }, client_stats, CALLCENTER_WORKERS) {
+            transport->set_connected_callback([this]() { client_stats.record_connected(); });
             // then we ping the visualizer regularly:
 
             register_function("whoami", std::bind(&Visualizer::whoami, this, _1, _2));
-            ping_thread = std::make_shared<std::thread>(&Visualizer::ping, this);
+            register_function("wire_formats", std::bind(&Visualizer::negotiate_wire_format, this, _1, _2));
+            register_function("resend_snapshots", std::bind(&Visualizer::resend_snapshots, this, _1, _2));
+            register_function("stats", std::bind(&Visualizer::report_stats, this, _1, _2));
+            // so that messages fed right away are not dropped; later
+            // attempts happen on the supervisor thread.
+            publisher_up.store(ensure_connection());
+            supervisor_thread = std::make_shared<std::thread>(&Visualizer::supervise, this);
         }
         Visualizer::~Visualizer() {
             running = false;
-            if (ping_thread != nullptr) {
-                ping_thread->join();
+            supervisor_wakeup.notify_one();
+            if (supervisor_thread != nullptr) {
+                supervisor_thread->join();
             }
-            if (callcenter_state == redox::Redox::CONNECTED) {
-                callcenter_main_phoneline->disconnect();
+            // handlers feed their replies, so they go before the queue.
+            callcenter.stop();
+            // partial windows go out rather than being lost.
+            flush_sampled_feeds(true);
+            {
+                std::lock_guard<std::mutex> guard(async_feed_mutex);
+                if (feed_queue_owner != nullptr) {
+                    // publisher drains what is left before exiting.
+                    feed_queue_owner->close();
+                    publisher_thread->join();
+                }
             }
-            if (rdx_state == redox::Redox::CONNECTED) {
-                rdx->disconnect();
+            auto log = std::atomic_load(&feed_log);
+            if (log != nullptr) {
+                log->flush();
             }
+            transport->disconnect();
         }
 
-        void Visualizer::ping() {
-            while (running) {
-                std::this_thread::sleep_for(std::chrono::seconds(1));
+        static const milliseconds HEARTBEAT_INTERVAL(1000);
+        static const milliseconds MIN_RECONNECT_BACKOFF(100);
+        static const milliseconds MAX_RECONNECT_BACKOFF(30000);
 
-                if (!ensure_connection()) {
-                    return;
+        void Visualizer::supervise() {
+            auto backoff = MIN_RECONNECT_BACKOFF;
+            // spreads out the retries of clients that lost the same server.
+            std::minstd_rand jitter(std::hash<std::string>()(my_uuid));
+            while (running) {
+                auto delay = HEARTBEAT_INTERVAL;
+                if (!publisher_up.load()) {
+                    delay = backoff + milliseconds(jitter() % (backoff.count() / 4 + 1));
+                }
+                {
+                    std::unique_lock<std::mutex> lock(supervisor_mutex);
+                    supervisor_wakeup.wait_for(lock, delay, [this]() {
+                        return !running || reconnect_requested.load();
+                    });
+                }
+                if (!running)
+                    break;
+                reconnect_requested.store(false);
+
+                bool connected = ensure_connection();
+                publisher_up.store(connected);
+                if (connected) {
+                    backoff = MIN_RECONNECT_BACKOFF;
+
+                    subscription_active = subscription_active && verify_subscription_active();
+
+                    if (!subscription_active && transport->subscriber_connected()) {
+                        update_subscriber();
+                    }
+                } else {
+                    backoff = std::min(backoff * 2, MAX_RECONNECT_BACKOFF);
                 }
 
-                subscription_active = subscription_active && verify_subscription_active();
+                // windows of keys nobody fed since they ended.
+                flush_sampled_feeds(false);
 
-                if (!subscription_active && callcenter_state == redox::Redox::CONNECTED) {
-                    update_subscriber();
+                if (connected) {
+                    feed(Json::object {
+                        { "type", "heartbeat" },
+                    });
                 }
-
-                feed(Json::object {
-                    { "type", "heartbeat" },
-                });
             }
         }
 
         void Visualizer::whoami(std::string fname, json11::Json ignored) {
+            // the server may have (re)started without us reconnecting.
+            vocabularies_synced.store(false);
             feed(Json::object {
                     { "type", "whoami" },
                     { "name", my_name},
             });
         }
 
+        void Visualizer::negotiate_wire_format(std::string fname, json11::Json payload) {
+            auto format = WireFormat::JSON;
+            for (auto& name: payload["formats"].array_items()) {
+                if (name.string_value() == BINARY_FORMAT_NAME) {
+                    format = WireFormat::BINARY;
+                }
+            }
+            wire_format.store((int)format);
+            feed(Json::object {
+                    { "type", "wire_format" },
+                    { "format", format == WireFormat::BINARY ? BINARY_FORMAT_NAME : "json" },
+            });
+        }
+
+        void Visualizer::report_stats(std::string fname, json11::Json ignored) {
+            feed(Json::object {
+                    { "type", "stats" },
+                    { "stats", stats_json() },
+            });
+        }
+
+        VisualizerStats& Visualizer::stats() {
+            return client_stats;
+        }
+
+        json11::Json Visualizer::stats_json() {
+            auto stats = client_stats.to_json().object_items();
+            FeedQueue* queue = feed_queue.load();
+            stats["dropped_overflow"] = queue != nullptr ? (double)queue->num_dropped() : 0.0;
+            return stats;
+        }
+
+        void Visualizer::resend_snapshots(std::string fname, json11::Json payload) {
+            std::lock_guard<std::mutex> guard(keyed_feeds_mutex);
+            for (auto& kv: keyed_feeds) {
+                if (payload["key"].is_null() || payload["key"].string_value() == kv.first) {
+                    kv.second->invalidate();
+                }
+            }
+        }
+
         bool Visualizer::verify_subscription_active() {
             auto requests_namespace = "callcenter_" + this->my_uuid;
 
-            for (auto& topic: callcenter_main_phoneline->subscribedTopics()) {
+            for (auto& topic: transport->subscribed_topics()) {
                 if (topic == requests_namespace) {
                     return true;
                 }
@@ -477,55 +829,385 @@ namespace dali {
             // we stop
                     std::this_thread::sleep_for(milliseconds(1000));
 
-            for (auto &topic : callcenter_main_phoneline->subscribedTopics()) {
-                callcenter_main_phoneline->unsubscribe(topic);
+            for (auto &topic : transport->subscribed_topics()) {
+                transport->unsubscribe(topic);
             }
             auto requests_namespace = "callcenter_" + this->my_uuid;
             // get ready to handle incoming requests:
-            callcenter_main_phoneline->subscribe(requests_namespace,
+            transport->subscribe(requests_namespace,
                     [this, requests_namespace](const string& topic, const string& msg) {
-                std::lock_guard<std::mutex> guard(this->callcenter_mutex);
-
                 assert2(topic == requests_namespace,
                         "Visualizer: Received message from unexpected channel.");
+                callcenter.dispatch(msg);
+            });
+            subscription_active = true;
+        }
 
-                std::string error;
-                auto msg_json = json11::Json::parse(msg, error);
+        void Visualizer::register_function(std::string name, function_t lambda) {
+            callcenter.register_handler(name, [lambda](std::shared_ptr<CallcenterCall> call) {
+                lambda(call->name, call->payload);
+                if (!call->id.is_null())
+                    call->finish();
+            });
+        }
 
-                if (!error.empty()) {
-                    std::cout << "VISUALIZER WARNING: error in requestion json: " << error << std::endl;
-                    return;
+        void Visualizer::register_rpc(std::string name, Callcenter::handler_t handler) {
+            callcenter.register_handler(name, handler);
+        }
+
+        vocabulary_ptr Visualizer::register_vocabulary(std::string name, std::vector<std::string> words) {
+            vocabulary_ptr vocabulary;
+            {
+                std::lock_guard<std::mutex> guard(vocabulary_mutex);
+                vocabulary = std::make_shared<Vocabulary>(vocabularies.size(), name, words);
+                vocabularies.push_back(vocabulary);
+            }
+            // Bypasses the feed queue so it cannot be dropped on overflow.
+            // If we are not synced yet, the next sync sends it anyway.
+            if (vocabularies_synced.load()) {
+                publish(vocabulary->to_json().dump());
+            } else {
+                auto log = std::atomic_load(&feed_log);
+                if (log != nullptr)
+                    append_to_log(log, vocabulary->to_json().dump());
+            }
+            return vocabulary;
+        }
+
+        void Visualizer::sync_vocabularies() {
+            std::lock_guard<std::mutex> guard(vocabulary_mutex);
+            for (auto& vocabulary: vocabularies) {
+                publish_raw(vocabulary->to_json().dump());
+            }
+        }
+
+        bool Visualizer::ready_to_publish() {
+            if (!publisher_up.load())
+                return false;
+            if (!transport->publisher_connected()) {
+                // the wakeup may be missed if the supervisor is between
+                // checking the flag and waiting; it then retries on its
+                // next heartbeat instead.
+                if (publisher_up.exchange(false)) {
+                    reconnect_requested.store(true);
+                    supervisor_wakeup.notify_one();
                 }
+                return false;
+            }
+            if (!vocabularies_synced.exchange(true)) {
+                sync_vocabularies();
+            }
+            return true;
+        }
 
-                if (msg_json["name"].is_null()) {
-                    std::cout << "VISUALIZER WARNING: received request without function name." << std::endl;
-                    return;
+
+        void Visualizer::enable_async_feed(size_t max_pending_messages, OverflowPolicy policy,
+                                           FeedSharding sharding) {
+            std::lock_guard<std::mutex> guard(async_feed_mutex);
+            if (feed_queue_owner != nullptr)
+                return;
+            std::shared_ptr<FeedQueue> queue;
+            if (sharding == FeedSharding::PER_THREAD) {
+                queue = std::make_shared<ShardedFeedQueue>(max_pending_messages, policy);
+            } else {
+                queue = std::make_shared<SharedFeedQueue>(max_pending_messages, policy);
+            }
+            feed_queue_owner = queue;
+            // the supervisor feeds heartbeats from construction on, so
+            // feed may be reading feed_queue right now.
+            feed_queue.store(queue.get());
+            publisher_thread = std::make_shared<std::thread>(&Visualizer::publisher_loop, this);
+        }
+
+        void Visualizer::enable_feed_batching(milliseconds window, size_t max_bytes, BatchMode mode) {
+            max_batch_bytes.store(max_bytes);
+            batch_mode.store((int)mode);
+            batch_window_ns.store(std::chrono::duration_cast<std::chrono::nanoseconds>(window).count());
+            enable_async_feed();
+        }
+
+        void Visualizer::publisher_loop() {
+            FeedQueue::message_t message;
+            // reused between messages and windows to avoid reallocating.
+            JsonWriter writer;
+            std::vector<std::string> batch;
+            auto serialize = [&writer, this](FeedQueue::message_t& message, std::string& out) {
+                if (message.payload.empty()) {
+                    auto start = std::chrono::steady_clock::now();
+                    writer.clear();
+                    writer.set_number_format(number_format());
+                    writer.value(message.obj);
+                    out.assign(writer.str());
+                    client_stats.serialize_time.record_since<std::chrono::steady_clock>(start);
+                } else {
+                    out.swap(message.payload);
                 }
-                auto& name = msg_json["name"].string_value();
-                if (this->callcenter_name_to_lambda.find(name) == this->callcenter_name_to_lambda.end()) {
-                    std::cout << "VISUALIZER WARNING: Requested function <" << name << "> not supported (did you forget to register?)." << std::endl;
-                    return;
+            };
+            FeedQueue* queue = feed_queue.load();
+            while (queue->pop(message)) {
+                auto window = std::chrono::nanoseconds(batch_window_ns.load());
+                if (window == std::chrono::nanoseconds::zero()) {
+                    batch.resize(1);
+                    serialize(message, batch[0]);
+                    publish(batch[0], message.enqueued);
+                    continue;
                 }
+                auto fed_at = message.enqueued;
+                auto deadline = FeedQueue::clock_t::now() + window;
+                size_t batch_bytes = 0;
+                size_t batch_size = 0;
+                do {
+                    if (batch.size() <= batch_size)
+                        batch.emplace_back();
+                    serialize(message, batch[batch_size]);
+                    batch_bytes += batch[batch_size].size();
+                    batch_size++;
+                } while (batch_bytes < max_batch_bytes.load() &&
+                         queue->pop_until(message, deadline));
+                batch.resize(batch_size);
+                publish_batch(batch, fed_at);
+            }
+        }
 
-                auto& f = this->callcenter_name_to_lambda.at(name);
+        void Visualizer::enable_fragment_cache(bool enabled) {
+            fragment_cache_enabled.store(enabled);
+        }
 
-                f(name, msg_json["payload"]);
+        void Visualizer::set_number_format(NumberFormat format) {
+            number_precision.store(format.precision);
+            keep_float32.store(format.keep_float32);
+        }
 
-            });
-            subscription_active = true;
+        NumberFormat Visualizer::number_format() const {
+            return NumberFormat(number_precision.load(), keep_float32.load());
         }
 
-        void Visualizer::register_function(std::string name, function_t lambda) {
-            std::lock_guard<std::mutex> guard(callcenter_mutex);
-            callcenter_name_to_lambda[name] = lambda;
+        void Visualizer::enable_compression(size_t threshold_bytes, int level) {
+            compression_level.store(level);
+            compression_threshold.store(threshold_bytes);
         }
 
+        void Visualizer::enable_feed_log(std::string directory, size_t segment_bytes) {
+            if (std::atomic_load(&feed_log) != nullptr)
+                return;
+            auto log = std::make_shared<FeedLog>(directory, updates_channel, segment_bytes);
+            // a replay has to be able to resolve word ids on its own.
+            std::lock_guard<std::mutex> guard(vocabulary_mutex);
+            for (auto& vocabulary: vocabularies) {
+                log->append(vocabulary->to_json().dump());
+            }
+            // the supervisor may be publishing heartbeats already.
+            std::atomic_store(&feed_log, log);
+        }
+
+        // A log that cannot be written (the disk filled up, say) is
+        // switched off rather than taking publishing down with it.
+        bool Visualizer::append_to_log(const std::shared_ptr<FeedLog>& log, const std::string& payload) {
+            try {
+                log->append(payload);
+                return true;
+            } catch (const std::runtime_error& e) {
+                std::shared_ptr<FeedLog> expected = log;
+                if (std::atomic_compare_exchange_strong(&feed_log, &expected, std::shared_ptr<FeedLog>())) {
+                    std::cout << "VISUALIZER WARNING: feed log disabled: " << e.what() << std::endl;
+                }
+                return false;
+            }
+        }
+
+        void Visualizer::publish(const std::string& payload) {
+            publish(payload, FeedQueue::clock_t::now());
+        }
+
+        void Visualizer::publish(const std::string& payload, FeedQueue::clock_t::time_point fed_at) {
+            auto log = std::atomic_load(&feed_log);
+            if (log != nullptr) {
+                append_to_log(log, payload);
+            }
+            if (!ready_to_publish()) {
+                client_stats.dropped_disconnected++;
+                return;
+            }
+
+            publish_raw(payload);
+            record_publish_latency(fed_at);
+        }
+
+        void Visualizer::record_publish_latency(FeedQueue::clock_t::time_point fed_at) {
+            int64_t sample = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    FeedQueue::clock_t::now() - fed_at).count();
+            // exponential moving average with weight 1/8; concurrent
+            // updates may lose a sample, which is fine for a trend.
+            client_stats.publish_latency.record(std::chrono::nanoseconds(sample));
+            int64_t average = publish_latency_ns.load();
+            publish_latency_ns.store(average + (sample - average) / 8);
+        }
+
+        FeedThrottle::Load Visualizer::publish_load() {
+            FeedThrottle::Load load;
+            FeedQueue* queue = feed_queue.load();
+            load.backlog = queue != nullptr ?
+                    (double)queue->size() / queue->max_size() : 0.0;
+            load.publish_latency = std::chrono::duration_cast<FeedThrottle::clock_t::duration>(
+                    std::chrono::nanoseconds(publish_latency_ns.load()));
+            return load;
+        }
+
+        // publishes on the updates channel, compressing if large enough.
+        void Visualizer::publish_raw(const std::string& payload) {
+            size_t threshold = compression_threshold.load();
+            if (threshold > 0 && payload.size() >= threshold) {
+                thread_local std::string compressed;
+                if (compress_message(payload, compression_level.load(), compressed)) {
+                    transport->publish(updates_channel, compressed);
+                    client_stats.record_publish(updates_channel, compressed.size());
+                    return;
+                }
+            }
+            transport->publish(updates_channel, payload);
+            client_stats.record_publish(updates_channel, payload.size());
+        }
+
+        void Visualizer::publish_batch(const std::vector<std::string>& batch,
+                                       FeedQueue::clock_t::time_point fed_at) {
+            auto log = std::atomic_load(&feed_log);
+            if (log != nullptr) {
+                for (auto& msg: batch) {
+                    if (!append_to_log(log, msg))
+                        break;
+                }
+            }
+            if (!ready_to_publish()) {
+                client_stats.dropped_disconnected += batch.size();
+                return;
+            }
+
+            if ((BatchMode)batch_mode.load() == BatchMode::PIPELINED) {
+                // redox does not wait for replies between commands, so
+                // these leave in a single burst.
+                for (auto& msg: batch) {
+                    publish_raw(msg);
+                }
+            } else {
+                // messages are already serialized; splice them in rather
+                // than building and dumping a Json::array again. Binary
+                // frames cannot be spliced into text and go out on their
+                // own, after the envelope of the messages before them.
+                const std::string envelope_start = "{\"messages\":[";
+                std::string envelope = envelope_start;
+                auto flush_envelope = [this, &envelope, &envelope_start]() {
+                    if (envelope.size() == envelope_start.size())
+                        return;
+                    envelope += "],\"type\":\"batch\"}";
+                    publish_raw(envelope);
+                    envelope = envelope_start;
+                };
+                for (auto& msg: batch) {
+                    if (is_binary_frame(msg)) {
+                        flush_envelope();
+                        publish_raw(msg);
+                        continue;
+                    }
+                    if (envelope.size() > envelope_start.size()) envelope += ",";
+                    envelope += msg;
+                }
+                flush_envelope();
+            }
+            record_publish_latency(fed_at);
+        }
 
         void Visualizer::feed(const json11::Json& obj) {
-            if (!ensure_connection())
+            FeedQueue* queue = feed_queue.load();
+            if (queue != nullptr) {
+                queue->push(FeedMessage{obj, std::string()});
                 return;
+            }
+            thread_local JsonWriter writer;
+            auto start = std::chrono::steady_clock::now();
+            writer.clear();
+            writer.set_number_format(number_format());
+            writer.value(obj);
+            client_stats.serialize_time.record_since<std::chrono::steady_clock>(start);
+            publish(writer.str());
+        }
 
-            rdx->publish(MS() << "updates_" << my_uuid, obj.dump());
+        void Visualizer::feed(Visualizable& obj) {
+            thread_local JsonWriter writer;
+            thread_local std::string payload;
+            auto format = (WireFormat)wire_format.load();
+            auto start = std::chrono::steady_clock::now();
+            writer.clear();
+            writer.set_binary_arrays(format == WireFormat::BINARY);
+            writer.set_fragment_cache(fragment_cache_enabled.load());
+            writer.set_number_format(number_format());
+            obj.write_json(writer);
+            encode_message(writer, format, payload);
+            client_stats.serialize_time.record_since<std::chrono::steady_clock>(start);
+            FeedQueue* queue = feed_queue.load();
+            if (queue != nullptr) {
+                queue->push(FeedMessage{json11::Json(), payload});
+                return;
+            }
+            publish(payload);
+        }
+
+        void Visualizer::feed_keyed(const std::string& key, Visualizable& obj, milliseconds snapshot_interval) {
+            std::shared_ptr<KeyedFeed> keyed_feed;
+            {
+                std::lock_guard<std::mutex> guard(keyed_feeds_mutex);
+                auto& entry = keyed_feeds[key];
+                if (entry == nullptr)
+                    entry = std::make_shared<KeyedFeed>(key);
+                keyed_feed = entry;
+            }
+            thread_local std::string payload;
+            auto start = std::chrono::steady_clock::now();
+            bool changed = keyed_feed->update(obj, snapshot_interval, payload,
+                                              fragment_cache_enabled.load(), number_format());
+            client_stats.serialize_time.record_since<std::chrono::steady_clock>(start);
+            if (!changed)
+                return;
+            FeedQueue* queue = feed_queue.load();
+            if (queue != nullptr) {
+                queue->push(FeedMessage{json11::Json(), payload});
+                return;
+            }
+            publish(payload);
+        }
+
+        std::shared_ptr<SampledFeed> Visualizer::sampled_feed(const std::string& key) {
+            std::lock_guard<std::mutex> guard(sampled_feeds_mutex);
+            auto& entry = sampled_feeds[key];
+            if (entry == nullptr)
+                entry = std::make_shared<SampledFeed>(key);
+            return entry;
+        }
+
+        void Visualizer::publish_sampled(SampledFeed& sampled, bool force) {
+            thread_local std::string payload;
+            auto start = std::chrono::steady_clock::now();
+            if (!sampled.flush(force, payload, number_format()))
+                return;
+            client_stats.serialize_time.record_since<std::chrono::steady_clock>(start);
+            FeedQueue* queue = feed_queue.load();
+            if (queue != nullptr) {
+                queue->push(FeedMessage{json11::Json(), payload});
+                return;
+            }
+            publish(payload);
+        }
+
+        void Visualizer::flush_sampled_feeds(bool force) {
+            std::vector<std::shared_ptr<SampledFeed>> feeds;
+            {
+                std::lock_guard<std::mutex> guard(sampled_feeds_mutex);
+                for (auto& kv: sampled_feeds) {
+                    feeds.push_back(kv.second);
+                }
+            }
+            for (auto& sampled: feeds) {
+                publish_sampled(*sampled, force);
+            }
         }
 
         void Visualizer::feed(const std::string& str) {
@@ -538,9 +1220,49 @@ namespace dali {
 
         void Visualizer::throttled_feed(Throttled::Clock::duration time_between_feeds,
                                         std::function<json11::Json()> f) {
-            throttle.maybe_run(time_between_feeds, [&f, this]() {
+            throttled_feed("", time_between_feeds, f);
+        }
+
+        void Visualizer::throttled_feed(const std::string& key,
+                                        Throttled::Clock::duration time_between_feeds,
+                                        std::function<json11::Json()> f,
+                                        ThrottleMode mode) {
+            // every thread remembers the throttles it used, so only the
+            // first use of a key on a thread takes throttles_mutex. The
+            // entries are weak so that a Visualizer reusing the address
+            // of a destroyed one does not pick up its throttles.
+            thread_local std::unordered_map<const Visualizer*,
+                    std::unordered_map<std::string, std::weak_ptr<FeedThrottle>>> known;
+            auto& entry = known[this][key];
+            std::shared_ptr<FeedThrottle> throttle = entry.lock();
+            if (throttle == nullptr) {
+                throttle = this->throttle(key);
+                entry = throttle;
+            }
+            throttled_feed(*throttle, time_between_feeds, f, mode);
+        }
+
+        std::shared_ptr<FeedThrottle> Visualizer::throttle(const std::string& key) {
+            std::lock_guard<std::mutex> guard(throttles_mutex);
+            auto& entry = throttles[key];
+            if (entry == nullptr)
+                entry = std::make_shared<FeedThrottle>();
+            return entry;
+        }
+
+        void Visualizer::throttled_feed(FeedThrottle& throttle,
+                                        Throttled::Clock::duration time_between_feeds,
+                                        std::function<json11::Json()> f,
+                                        ThrottleMode mode) {
+            FeedThrottle::Load load;
+            if (mode == ThrottleMode::ADAPTIVE) {
+                load = publish_load();
+            } else {
+                load = FeedThrottle::Load{0.0, FeedThrottle::clock_t::duration::zero()};
+            }
+            if (throttle.try_run(time_between_feeds, mode, load)) {
                 feed(f());
-            });
+            }
         }
     }
 }
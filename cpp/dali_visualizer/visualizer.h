@@ -7,13 +7,27 @@
 #include <dali/utils/core_utils.h>
 #include <dali/utils/Reporting.h>
 #include <json11.hpp>
-#include <redox.hpp>
+#include <atomic>
 #include <memory>
 #include <chrono>
+#include <condition_variable>
 #include <functional>
 #include <string>
 
+#include "dali_visualizer/Callcenter.h"
 #include "dali_visualizer/EventQueue.h"
+#include "dali_visualizer/FeedLog.h"
+#include "dali_visualizer/FeedQueue.h"
+#include "dali_visualizer/FeedThrottle.h"
+#include "dali_visualizer/JsonWriter.h"
+#include "dali_visualizer/KeyedFeed.h"
+#include "dali_visualizer/SampledFeed.h"
+#include "dali_visualizer/ShardedFeedQueue.h"
+#include "dali_visualizer/Stats.h"
+#include "dali_visualizer/Transport.h"
+#include "dali_visualizer/Vocabulary.h"
+#include "dali_visualizer/Weights.h"
+#include "dali_visualizer/WireFormat.h"
 
 // to import Throttled
 
@@ -22,21 +36,54 @@ namespace dali {
     namespace visualizer {
 
         struct Visualizable {
+            // content_version of output that may change without
+            // mark_changed being called; it is never cached.
+            static const uint64_t VOLATILE = 0;
+
+            // what the object last serialized to, see
+            // JsonWriter::set_fragment_cache.
+            FragmentCache fragment_cache;
+
+            Visualizable();
+            virtual ~Visualizable();
+
             virtual json11::Json to_json() = 0;
+            // Serializes straight into writer's buffer. Defaults to
+            // writing to_json(), so subclasses only need to override it
+            // to skip building the intermediate json11 tree.
+            virtual void write_json(JsonWriter& writer);
+
+            // Changes whenever this object or anything below it is
+            // marked changed. VOLATILE unless the subclass tracks its
+            // changes (the built-in ones do, except for weights that
+            // share a Mat's storage).
+            virtual uint64_t content_version();
+            // Setters such as set_weights and add_in_column call this;
+            // call it after assigning fields directly.
+            void mark_changed();
+
+            protected:
+                uint64_t version;
         };
 
         template<typename R>
         struct Sentence : public Visualizable {
             std::vector<std::string> tokens;
-            std::vector<R> weights;
+            Weights<R> weights;
             bool spaces = true;
+            // when set (and it contains every token) tokens are sent as
+            // indices into it.
+            vocabulary_ptr vocabulary;
 
             Sentence(std::vector<std::string> tokens);
 
             void set_weights(const std::vector<R>& _weights);
+            // Keeps a reference to _weights' storage instead of copying it.
             void set_weights(const Mat<R>& _weights);
 
             virtual json11::Json to_json() override;
+            virtual void write_json(JsonWriter& writer) override;
+            virtual uint64_t content_version() override;
         };
 
         template<typename R>
@@ -46,15 +93,18 @@ namespace dali {
         struct Sentences : public Visualizable {
             typedef std::shared_ptr<Sentence<R>> sentence_ptr;
             std::vector<sentence_ptr> sentences;
-            std::vector<R> weights;
+            Weights<R> weights;
 
             Sentences(std::vector<sentence_ptr> sentences);
             Sentences(std::vector<std::vector<std::string>> vec);
 
             void set_weights(const std::vector<R>& _weights);
+            // Keeps a reference to _weights' storage instead of copying it.
             void set_weights(const Mat<R>& _weights);
 
             virtual json11::Json to_json() override;
+            virtual void write_json(JsonWriter& writer) override;
+            virtual uint64_t content_version() override;
         };
 
         template<typename R>
@@ -64,6 +114,8 @@ namespace dali {
             sentence_ptr sentence2;
             ParallelSentence(sentence_ptr sentence1, sentence_ptr sentence2);
             virtual json11::Json to_json() override;
+            virtual void write_json(JsonWriter& writer) override;
+            virtual uint64_t content_version() override;
         };
 
         template<typename R>
@@ -77,6 +129,8 @@ namespace dali {
             QA(visualizable_ptr context, sentence_ptr question, sentence_ptr answer);
 
             virtual json11::Json to_json() override;
+            virtual void write_json(JsonWriter& writer) override;
+            virtual uint64_t content_version() override;
         };
 
         struct GridLayout : public Visualizable {
@@ -89,6 +143,8 @@ namespace dali {
             void add_in_column(int column, visualizable_ptr);
 
             virtual json11::Json to_json() override;
+            virtual void write_json(JsonWriter& writer) override;
+            virtual uint64_t content_version() override;
         };
 
         template<typename R>
@@ -98,6 +154,12 @@ namespace dali {
             std::vector<R> scores;
             std::vector<std::string> labels;
             int top_picks;
+            // when set (and it contains every label) labels are sent as
+            // indices into it.
+            vocabulary_ptr vocabulary;
+
+            // indices of the top_picks most likely outcomes, best first.
+            std::vector<size_t> top_pick_indices() const;
 
             FiniteDistribution(const std::vector<R>& distribution,
                                const std::vector<R>& scores,
@@ -109,6 +171,8 @@ namespace dali {
                    int max_top_picks = -1);
 
             virtual json11::Json to_json() override;
+            virtual void write_json(JsonWriter& writer) override;
+            virtual uint64_t content_version() override;
         };
 
         template<typename T>
@@ -118,6 +182,8 @@ namespace dali {
             Probability(T probability);
 
             virtual json11::Json to_json() override;
+            virtual void write_json(JsonWriter& writer) override;
+            virtual uint64_t content_version() override;
         };
 
         struct Message: public Visualizable {
@@ -126,6 +192,8 @@ namespace dali {
             Message(std::string content);
 
             virtual json11::Json to_json() override;
+            virtual void write_json(JsonWriter& writer) override;
+            virtual uint64_t content_version() override;
         };
 
         struct Tree: public Visualizable {
@@ -143,16 +211,27 @@ namespace dali {
             Tree(std::string label, std::vector<std::shared_ptr<Tree>> children);
 
             virtual json11::Json to_json() override;
+            virtual void write_json(JsonWriter& writer) override;
+            virtual uint64_t content_version() override;
         };
 
+        // With max_top_picks > 0 only the most likely labels are sent,
+        // sorted by decreasing probability.
         template<typename R>
-        json11::Json json_finite_distribution(const Mat<R>&, const std::vector<std::string>& labels);
+        json11::Json json_finite_distribution(const Mat<R>&, const std::vector<std::string>& labels, int max_top_picks = -1);
 
         template<typename R>
-        json11::Json json_classification(const std::vector<std::string>& sentence, const Mat<R>& probs, const std::vector<std::string>& label_names);
+        json11::Json json_classification(const std::vector<std::string>& sentence, const Mat<R>& probs, const std::vector<std::string>& label_names, int max_top_picks = -1);
 
         template<typename R>
-        json11::Json json_classification(const std::vector<std::string>& sentence, const Mat<R>& probs, const Mat<R>& word_weights, const std::vector<std::string>& label_names);
+        json11::Json json_classification(const std::vector<std::string>& sentence, const Mat<R>& probs, const Mat<R>& word_weights, const std::vector<std::string>& label_names, int max_top_picks = -1);
+
+        // How a window of coalesced messages goes out, see
+        // Visualizer::enable_feed_batching.
+        enum class BatchMode {
+            PIPELINED, // one PUBLISH per message, sent back to back
+            ENVELOPE   // a single {"type": "batch", "messages": [...]} PUBLISH
+        };
 
         // TODO: explain what this does
         class Visualizer {
@@ -162,43 +241,245 @@ namespace dali {
                 const int port;
             private:
                 bool subscription_active = false;
-                bool running;
+                std::atomic<bool> running;
 
                 std::string my_uuid;
                 std::string my_name;
+                std::string updates_channel;
 
-                std::shared_ptr<redox::Redox> rdx;
-                std::shared_ptr<redox::Subscriber> callcenter_main_phoneline;
-
-                Throttled throttle;
+                std::shared_ptr<Transport> transport;
 
+                // only the supervisor (and the constructor) connect; feed
+                // just reads publisher_up.
                 std::mutex connection_mutex;
-                std::shared_ptr<std::thread> ping_thread;
-
-                std::mutex callcenter_mutex;
-                std::unordered_map<std::string, function_t> callcenter_name_to_lambda;
-
-                std::atomic<int> rdx_state;
-                std::atomic<int> callcenter_state;
+                std::atomic<bool> publisher_up;
+                std::shared_ptr<std::thread> supervisor_thread;
+                std::mutex supervisor_mutex;
+                std::condition_variable supervisor_wakeup;
+                // set when feed notices the connection dropped, so the
+                // supervisor reconnects without waiting for the heartbeat.
+                std::atomic<bool> reconnect_requested;
+
+                // only set in async mode, see enable_async_feed. The
+                // owner is set once under async_feed_mutex and kept until
+                // the Visualizer goes away; feed reads the plain atomic
+                // pointer, so feeding threads share no lock on their way
+                // to the queue (or their shard of it).
+                std::mutex async_feed_mutex;
+                std::shared_ptr<FeedQueue> feed_queue_owner;
+                std::atomic<FeedQueue*> feed_queue;
+                std::shared_ptr<std::thread> publisher_thread;
+
+                // only set once enable_feed_log was called; read and set
+                // with atomic_load/atomic_store.
+                std::shared_ptr<FeedLog> feed_log;
+
+                // batching is off while batch_window_ns is zero.
+                std::atomic<int64_t> batch_window_ns;
+                std::atomic<size_t> max_batch_bytes;
+                std::atomic<int> batch_mode;
+
+                std::atomic<bool> fragment_cache_enabled;
+
+                // see set_number_format.
+                std::atomic<int> number_precision;
+                std::atomic<bool> keep_float32;
+                NumberFormat number_format() const;
+
+                // compression is off while compression_threshold is zero.
+                std::atomic<size_t> compression_threshold;
+                std::atomic<int> compression_level;
+
+                // WireFormat for visualizables, see negotiate_wire_format.
+                std::atomic<int> wire_format;
+
+                std::mutex vocabulary_mutex;
+                std::vector<vocabulary_ptr> vocabularies;
+                // false until every vocabulary went out on the current
+                // connection.
+                std::atomic<bool> vocabularies_synced;
+
+                std::mutex keyed_feeds_mutex;
+                std::unordered_map<std::string, std::shared_ptr<KeyedFeed>> keyed_feeds;
+
+                std::mutex sampled_feeds_mutex;
+                std::unordered_map<std::string, std::shared_ptr<SampledFeed>> sampled_feeds;
+
+                std::mutex throttles_mutex;
+                std::unordered_map<std::string, std::shared_ptr<FeedThrottle>> throttles;
+                // moving average of the time from feed until publish
+                // returns, see FeedThrottle::Load.
+                std::atomic<int64_t> publish_latency_ns;
+
+                VisualizerStats client_stats;
+
+                Callcenter callcenter;
 
                 void update_subscriber();
 
-                void rdx_connected_callback(int status);
-                void callcenter_connected_callback(int status);
                 bool ensure_connection();
-                void ping();
+                // Reconnects (retrying with exponential backoff for as
+                // long as the client lives), keeps the callcenter
+                // subscription up and sends heartbeats.
+                void supervise();
                 bool verify_subscription_active();
+                bool ready_to_publish();
+                void sync_vocabularies();
+                // false if the log failed, and is off from now on.
+                bool append_to_log(const std::shared_ptr<FeedLog>& log, const std::string& payload);
+                void publish(const std::string& payload);
+                // fed_at is when the oldest message in payload was fed.
+                void publish(const std::string& payload, FeedQueue::clock_t::time_point fed_at);
+                void publish_raw(const std::string& payload);
+                void publish_batch(const std::vector<std::string>& batch,
+                                   FeedQueue::clock_t::time_point fed_at);
+                void record_publish_latency(FeedQueue::clock_t::time_point fed_at);
+                FeedThrottle::Load publish_load();
+                void publisher_loop();
+                std::shared_ptr<SampledFeed> sampled_feed(const std::string& key);
+                void publish_sampled(SampledFeed& sampled, bool force);
+                // publishes every window that is over (or all, if force).
+                void flush_sampled_feeds(bool force);
+
+                Visualizer(std::string name, std::string hostname, int port,
+                           std::shared_ptr<Transport> transport);
             public:
                 void whoami(std::string, json11::Json);
-
+                // Callcenter request from the server listing the wire
+                // formats it can decode: {"formats": ["dvb1", ...]}.
+                // Anything not listed falls back to JSON.
+                void negotiate_wire_format(std::string, json11::Json);
+                // Callcenter request: the next feed_keyed of every key
+                // (or of payload["key"] only) sends a full snapshot.
+                void resend_snapshots(std::string, json11::Json);
+                // Callcenter request: feeds {"type": "stats", "stats": ..}
+                // with stats_json().
+                void report_stats(std::string, json11::Json);
+
+                // What this client has cost so far: messages and bytes per
+                // channel, serialization time, publish latency, drops and
+                // reconnects, callcenter dispatch time.
+                VisualizerStats& stats();
+                // stats() plus the feed queue's drop count.
+                json11::Json stats_json();
+
+                // lambda gets the request's name and payload. If the
+                // request carries an "id", a final reply without result
+                // goes out once lambda returns.
                 void register_function(std::string name,  function_t lambda);
+                // For functions that answer: handler replies (or streams
+                // parts of a reply) through the call, see CallcenterCall.
+                void register_rpc(std::string name, Callcenter::handler_t handler);
+
+                // Publishes words once; visualizables pointing at the
+                // returned vocabulary then refer to them by index. All
+                // vocabularies are sent again after a reconnect and on
+                // every whoami request.
+                vocabulary_ptr register_vocabulary(std::string name, std::vector<std::string> words);
 
                 Visualizer(std::string name, std::string hostname="127.0.0.1", int port=6397);
+                // Publishes and takes callcenter requests through transport
+                // instead, e.g. redis_unix_transport(path) or an
+                // InProcessTransport.
+                Visualizer(std::string name, std::shared_ptr<Transport> transport);
                 ~Visualizer();
 
+                // From now on feed only enqueues the message and returns
+                // immediately. Serialization and publishing happen on a
+                // dedicated publisher thread. Safe to call while other
+                // threads feed; only the first call has an effect. With
+                // FeedSharding::PER_THREAD every
+                // feeding thread gets its own buffer (of
+                // max_pending_messages), so feed does not contend with
+                // other feeding threads; messages of one thread still go
+                // out in order.
+                void enable_async_feed(size_t max_pending_messages=1024,
+                                       OverflowPolicy policy=OverflowPolicy::DROP_OLDEST,
+                                       FeedSharding sharding=FeedSharding::SHARED);
+
+                // Coalesce messages fed within window (or until
+                // max_bytes of payload accumulate) and send them together.
+                // Turns on async feed if it is not already on.
+                void enable_feed_batching(std::chrono::milliseconds window,
+                                          size_t max_bytes=64 * 1024,
+                                          BatchMode mode=BatchMode::PIPELINED);
+
+                // Messages of at least threshold_bytes are zlib-compressed
+                // at the given level (1 fastest ... 9 smallest) before they
+                // are published, see compress_message. The server has to
+                // recognize the DVZ1 frame.
+                void enable_compression(size_t threshold_bytes=16 * 1024, int level=1);
+
+                // Children of fed visualizables that did not change since
+                // they were last serialized are spliced in from their
+                // FragmentCache instead of being serialized again. Only
+                // turn it on if visualizables are changed through their
+                // setters, or mark_changed is called after changing their
+                // fields.
+                void enable_fragment_cache(bool enabled=true);
+
+                // How numbers in fed messages are written as text, e.g.
+                // NumberFormat(0, true) for the shortest digits that
+                // still read back as the same float32, or NumberFormat(4)
+                // to send weights with 4 significant digits.
+                void set_number_format(NumberFormat format);
+
+                // Appends every message (whether or not it could be
+                // published) and every vocabulary to a memory-mapped log
+                // in directory, which has to exist, starting a new segment
+                // file every segment_bytes. Messages fed while redis is
+                // unreachable can then be republished with
+                // dali_visualizer_replay. Call before feeding.
+                void enable_feed_log(std::string directory, size_t segment_bytes=64 << 20);
+
                 void feed(const json11::Json& obj);
                 void feed(const std::string& str);
+                // Serialized on the calling thread (through write_json),
+                // since the object may change after feed returns.
+                void feed(Visualizable& obj);
+                // For visualizables that are re-fed over and over under the
+                // same key: only the children that changed since the last
+                // call are published, see KeyedFeed. Always sent as JSON.
+                void feed_keyed(const std::string& key, Visualizable& obj,
+                                std::chrono::milliseconds snapshot_interval=std::chrono::seconds(10));
+                // Keeps a uniform sample of at most sample_size of the
+                // candidates fed under key during each window, and
+                // publishes them in one message once the window is over
+                // (see SampledFeed). make returns a shared_ptr to a
+                // Visualizable and only runs for candidates that get
+                // sampled, so the serialization cost per window is fixed
+                // however often this is called. Samples are serialized
+                // when the window is published, so the object make
+                // returns has to own its data (no Weights sharing a Mat
+                // that training keeps updating).
+                template<typename F>
+                void feed_sampled(const std::string& key, F make,
+                                  std::chrono::milliseconds window,
+                                  size_t sample_size=4) {
+                    auto sampled = sampled_feed(key);
+                    // a window that is over goes out before this
+                    // candidate, which starts the next one.
+                    publish_sampled(*sampled, false);
+                    sampled->offer(make, window, sample_size);
+                }
+                // f runs (and its result is fed) at most once every
+                // time_between_feeds across all unnamed calls.
                 void throttled_feed(Throttled::Clock::duration time_between_feeds, std::function<json11::Json()> f);
+                // Same, but every key is throttled on its own, so
+                // independent reporters do not hold each other back. In
+                // ADAPTIVE mode the interval stretches while the feed
+                // queue backs up or publishing slows down, see FeedThrottle.
+                void throttled_feed(const std::string& key,
+                                    Throttled::Clock::duration time_between_feeds,
+                                    std::function<json11::Json()> f,
+                                    ThrottleMode mode=ThrottleMode::FIXED);
+                // The throttle behind key, for callers that feed through
+                // it often: keeping it skips the lookup on every call.
+                std::shared_ptr<FeedThrottle> throttle(const std::string& key);
+                void throttled_feed(FeedThrottle& throttle,
+                                    Throttled::Clock::duration time_between_feeds,
+                                    std::function<json11::Json()> f,
+                                    ThrottleMode mode=ThrottleMode::FIXED);
         };
     }
 }
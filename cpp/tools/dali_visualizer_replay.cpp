@@ -0,0 +1,167 @@
+// Republishes a feed log written with Visualizer::enable_feed_log.
+//
+//     ./dali_visualizer_replay log_directory [--redis host:port]
+//                              [--redis-unix socket_path] [--channel name]
+//                              [--from time] [--to time]
+//                              [--speed factor | --rate messages_per_second]
+//
+// Times are seconds since the epoch, or seconds since the first message
+// of the log when prefixed with '+' (e.g. --from +60 --to +120). By
+// default messages go out with their original spacing (--speed 1);
+// --speed 0 sends them as fast as possible and --rate at a fixed rate.
+// Messages go to the channel they were logged for unless --channel is
+// given. Vocabularies logged before --from are sent ahead of the range,
+// so that the word and label ids in it can be resolved.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <json11.hpp>
+
+#include "dali_visualizer/FeedLog.h"
+#include "dali_visualizer/Transport.h"
+
+using namespace std::chrono;
+using namespace dali::visualizer;
+
+typedef FeedLog::clock_t::time_point log_time_t;
+
+struct TimeBound {
+    bool set = false;
+    bool relative = false;
+    double seconds = 0;
+
+    log_time_t resolve(log_time_t log_start) const {
+        auto offset = duration_cast<FeedLog::clock_t::duration>(duration<double>(seconds));
+        return relative ? log_start + offset : log_time_t(offset);
+    }
+};
+
+static TimeBound parse_time(const char* arg) {
+    TimeBound bound;
+    bound.set = true;
+    bound.relative = arg[0] == '+';
+    bound.seconds = atof(arg + (bound.relative ? 1 : 0));
+    return bound;
+}
+
+static bool is_vocabulary(const FeedLogReader::Record& record) {
+    static const char needle[] = "vocabulary";
+    if (std::search(record.data, record.data + record.size,
+                    needle, needle + sizeof(needle) - 1) == record.data + record.size)
+        return false;
+    std::string error;
+    auto message = json11::Json::parse(std::string(record.data, record.size), error);
+    return error.empty() && message["type"].string_value() == "vocabulary";
+}
+
+static int usage(const char* program) {
+    fprintf(stderr, "usage: %s log_directory [--redis host:port] [--redis-unix socket_path] "
+                    "[--channel name] [--from time] [--to time] "
+                    "[--speed factor | --rate messages_per_second]\n", program);
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argv[1][0] == '-')
+        return usage(argv[0]);
+    std::string directory = argv[1];
+    std::string host = "127.0.0.1";
+    int port = 6379;
+    std::string socket_path;
+    std::string channel;
+    TimeBound from, to;
+    double speed = 1.0;
+    double rate = 0.0;
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "--redis") == 0 && i + 1 < argc) {
+            std::string address = argv[++i];
+            auto colon = address.rfind(':');
+            host = address.substr(0, colon);
+            if (colon != std::string::npos)
+                port = atoi(address.c_str() + colon + 1);
+        } else if (strcmp(argv[i], "--redis-unix") == 0 && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (strcmp(argv[i], "--channel") == 0 && i + 1 < argc) {
+            channel = argv[++i];
+        } else if (strcmp(argv[i], "--from") == 0 && i + 1 < argc) {
+            from = parse_time(argv[++i]);
+        } else if (strcmp(argv[i], "--to") == 0 && i + 1 < argc) {
+            to = parse_time(argv[++i]);
+        } else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            speed = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+            rate = atof(argv[++i]);
+        } else {
+            return usage(argv[0]);
+        }
+    }
+
+    auto transport = socket_path.empty() ? redis_transport(host, port) :
+                                           redis_unix_transport(socket_path);
+    bool restarted;
+    auto give_up = steady_clock::now() + seconds(10);
+    while (!transport->ensure_publisher(restarted)) {
+        if (steady_clock::now() > give_up) {
+            fprintf(stderr, "could not connect to redis\n");
+            return 1;
+        }
+        std::this_thread::sleep_for(milliseconds(100));
+    }
+
+    size_t replayed = 0;
+    try {
+        FeedLogReader reader(directory);
+        FeedLogReader::Record record;
+        bool started = false;
+        log_time_t log_start, first_replayed;
+        steady_clock::time_point replay_start;
+        std::string message;
+        while (reader.next(record)) {
+            if (!started) {
+                log_start = record.when;
+                started = true;
+            }
+            if (from.set && record.when < from.resolve(log_start)) {
+                if (is_vocabulary(record)) {
+                    message.assign(record.data, record.size);
+                    transport->publish(channel.empty() ? *record.channel : channel, message);
+                }
+                continue;
+            }
+            // the reader merges segments by time, so nothing after this
+            // is in range either.
+            if (to.set && record.when > to.resolve(log_start))
+                break;
+
+            if (replayed == 0) {
+                first_replayed = record.when;
+                replay_start = steady_clock::now();
+            } else if (rate > 0) {
+                std::this_thread::sleep_until(replay_start +
+                        duration_cast<steady_clock::duration>(duration<double>(replayed / rate)));
+            } else if (speed > 0 && record.when > first_replayed) {
+                // the system clock of the writer may have stepped back;
+                // such records go out right away.
+                std::this_thread::sleep_until(replay_start +
+                        duration_cast<steady_clock::duration>((record.when - first_replayed) / speed));
+            }
+            message.assign(record.data, record.size);
+            transport->publish(channel.empty() ? *record.channel : channel, message);
+            replayed++;
+        }
+    } catch (std::runtime_error& error) {
+        fprintf(stderr, "%s\n", error.what());
+        return 1;
+    }
+    // publish only queues the command.
+    if (!transport->flush())
+        fprintf(stderr, "could not confirm that every message was delivered\n");
+    transport->disconnect();
+    fprintf(stderr, "replayed %zu messages\n", replayed);
+}